@@ -0,0 +1,206 @@
+#include "stdafx.h"
+#include "fileinfo.hpp"
+#include "filterbank.hpp"
+#include "hdf5.hpp"
+#include "threadpool.hpp"
+
+namespace {
+    /* minimum number of threads reading headers in stat_files */
+    const int STAT_MIN_THREADS = 16;
+
+    /* one column of a file's row in a table; a value that is empty and not a string is missing (e.g. NAN) */
+    struct Field {
+        const char * name;
+        std::string value;
+        bool is_string;
+    };
+
+    std::string _num(double x) {
+        if (std::isnan(x)) return "";
+        std::ostringstream ss;
+        ss << std::setprecision(17) << x;
+        return ss.str();
+    }
+
+    std::string _num(int64_t x) {
+        return std::to_string(x);
+    }
+
+    /* helper for listing the columns of a file's row */
+    std::vector<Field> _fields(const watplot::FileInfo & info) {
+        const watplot::FileHeader & h = info.header;
+        bool ok = info.ok();
+        return std::vector<Field> {
+            { "path", info.path, true },
+            { "format", info.format, true },
+            { "error", info.error, true },
+            { "telescope", ok ? info.telescope_name() : "", true },
+            { "source_name", h.source_name, true },
+            { "rawdatafile", h.rawdatafile, true },
+            { "src_raj", _num(h.src_raj), false },
+            { "src_dej", _num(h.src_dej), false },
+            { "tstart", _num(h.tstart), false },
+            { "tsamp", _num(h.tsamp), false },
+            { "fch1", _num(h.fch1), false },
+            { "foff", _num(h.foff), false },
+            { "nchans", _num(int64_t(h.nchans)), false },
+            { "nifs", _num(int64_t(h.nifs)), false },
+            { "nbits", _num(int64_t(h.nbits)), false },
+            { "nints", _num(info.nints), false },
+            { "f_min", _num(info.f_min()), false },
+            { "f_max", _num(info.f_max()), false },
+            { "t_min", _num(info.t_min()), false },
+            { "t_max", _num(info.t_max()), false },
+            { "file_size_bytes", _num(info.file_size_bytes), false },
+            { "data_size_bytes", _num(info.data_size_bytes), false },
+        };
+    }
+
+    std::string _csv_escape(const std::string & s) {
+        if (s.find_first_of(",\"\r\n") == std::string::npos) return s;
+        std::string out = "\"";
+        for (char c : s) {
+            if (c == '"') out.push_back('"');
+            out.push_back(c);
+        }
+        return out + "\"";
+    }
+
+    std::string _json_escape(const std::string & s) {
+        std::string out = "\"";
+        for (char c : s) {
+            if (c == '"' || c == '\\') {
+                out.push_back('\\');
+                out.push_back(c);
+            }
+            else if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned char>(c));
+                out += buf;
+            }
+            else {
+                out.push_back(c);
+            }
+        }
+        return out + "\"";
+    }
+}
+
+namespace watplot {
+    double FileInfo::f_min() const {
+        return header.nchans > 0 ? freq_axis().front() : NAN;
+    }
+
+    double FileInfo::f_max() const {
+        return header.nchans > 0 ? freq_axis().back() : NAN;
+    }
+
+    double FileInfo::t_min() const {
+        return nints > 0 ? time_axis().front() : NAN;
+    }
+
+    double FileInfo::t_max() const {
+        return nints > 0 ? time_axis().back() : NAN;
+    }
+
+    std::string FileInfo::telescope_name() const {
+        if (header.telescope_id >= 0 && header.telescope_id < static_cast<int>(consts::TELESCOPES.size())) {
+            return consts::TELESCOPES[header.telescope_id];
+        }
+        return std::to_string(header.telescope_id);
+    }
+
+    FileInfo stat_file(const std::string & path) {
+        FileInfo info;
+        info.path = path;
+        struct stat st;
+        if (stat(path.c_str(), &st)) {
+            info.error = "File not found";
+            return info;
+        }
+        info.file_size_bytes = static_cast<int64_t>(st.st_size);
+
+        std::string ext = path.substr(path.find_last_of(".") + 1);
+        if (ext == "fil") {
+            if (!Filterbank::read_info(path, info)) return info;
+            // (implementations which know the number of time integrations set it in read_info)
+            int64_t row_bits = int64_t(info.header.nbits) * info.header.nchans * max(info.header.nifs, 1);
+            if (row_bits > 0) info.nints = info.data_size_bytes * 8 / row_bits;
+        }
+        else if (ext == "h5" || ext == "hdf5") {
+            HDF5::read_info(path, info);
+        }
+        else {
+            info.error = "Unrecognized extension: \"" + ext + "\"";
+        }
+        return info;
+    }
+
+    std::vector<FileInfo> stat_files(const std::vector<std::string> & paths) {
+        std::vector<FileInfo> infos(paths.size());
+        ThreadPool pool(max(ThreadPool::default_size(), STAT_MIN_THREADS));
+        pool.parallel_for(0, static_cast<int>(paths.size()), 1, [&](int lo, int hi) {
+            for (int i = lo; i < hi; ++i) infos[i] = stat_file(paths[i]);
+        });
+        return infos;
+    }
+
+    void write_csv(std::ostream & o, const std::vector<FileInfo> & infos) {
+        std::vector<Field> columns = _fields(FileInfo());
+        for (size_t j = 0; j < columns.size(); ++j) {
+            o << (j ? "," : "") << columns[j].name;
+        }
+        o << "\n";
+        for (const FileInfo & info : infos) {
+            std::vector<Field> fields = _fields(info);
+            for (size_t j = 0; j < fields.size(); ++j) {
+                o << (j ? "," : "") << _csv_escape(fields[j].value);
+            }
+            o << "\n";
+        }
+    }
+
+    void write_json(std::ostream & o, const std::vector<FileInfo> & infos) {
+        o << "[\n";
+        for (size_t i = 0; i < infos.size(); ++i) {
+            std::vector<Field> fields = _fields(infos[i]);
+            o << "{";
+            for (size_t j = 0; j < fields.size(); ++j) {
+                const Field & f = fields[j];
+                o << (j ? ", " : "") << "\"" << f.name << "\": ";
+                if (f.is_string) o << _json_escape(f.value);
+                else o << (f.value.empty() ? "null" : f.value);
+            }
+            o << "}" << (i + 1 < infos.size() ? "," : "") << "\n";
+        }
+        o << "]\n";
+    }
+
+    std::ostream & operator<< (std::ostream & o, const FileInfo & info) {
+        o << "---------------------------------\n";
+        o << "Breakthrough Listen data file\n";
+        o << "File:\t\t" << info.path << "\n";
+        if (!info.ok()) {
+            o << "Error:\t\t" << info.error << "\n";
+            o << "---------------------------------\n";
+            return o;
+        }
+        o << "Format:\t\t" << info.format << "\n";
+        o << "Telescope:\t" << info.telescope_name() << "\n";
+        o << "Source:\t\t" << info.header.source_name << "\n";
+        o << "Raw file:\t" << info.header.rawdatafile << "\n";
+        o << "\nData Format\n";
+        if (info.nints > 0) {
+            o << "Time axis:\t\t" << info.nints << " timestamps\n Range:\t\t\t[" <<
+                info.t_min() << ", " << info.t_max() << "]\n";
+        }
+        if (info.header.nchans > 0) {
+            o << "Frequency axis:\t\t" << info.header.nchans << " channels\n Range:\t\t\t[" <<
+                info.f_min() << ", " << info.f_max() << "]\n";
+        }
+        o << "Bits per sample:\t" << info.header.nbits << "\n\nStatistics\n";
+        o << "File size:\t\t" << info.file_size_bytes << " bytes (data: " << info.data_size_bytes << ")\n";
+        o << "---------------------------------\n";
+        return o;
+    }
+}
@@ -0,0 +1,66 @@
+#include "stdafx.h"
+#include "filewatcher.hpp"
+
+#ifdef __linux__
+    #include <sys/inotify.h>
+#endif
+
+namespace watplot {
+    FileWatcher::FileWatcher(const std::string & path, double min_interval)
+        : path(path), min_interval(min_interval) {
+#ifdef __linux__
+        notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (notify_fd >= 0) {
+            watch_fd = inotify_add_watch(notify_fd, path.c_str(), IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB);
+            if (watch_fd < 0) {
+                ::close(notify_fd);
+                notify_fd = -1;
+            }
+        }
+#endif
+        if (notify_fd < 0) {
+            std::cerr << "FileWatcher: inotify unavailable, polling " << path << "\n";
+        }
+        last_report = last_poll = std::chrono::steady_clock::now();
+        _check();
+        pending = false;
+    }
+
+    FileWatcher::~FileWatcher() {
+#ifdef __linux__
+        if (notify_fd >= 0) ::close(notify_fd);
+#endif
+    }
+
+    bool FileWatcher::changed() {
+        if (_check()) pending = true;
+        if (!pending) return false;
+        auto now = std::chrono::steady_clock::now();
+        if (std::chrono::duration<double>(now - last_report).count() < min_interval) return false;
+        last_report = now;
+        pending = false;
+        return true;
+    }
+
+    bool FileWatcher::_check() {
+#ifdef __linux__
+        if (notify_fd >= 0) {
+            // drain all pending events
+            alignas(inotify_event) char buf[4096];
+            bool any = false;
+            while (read(notify_fd, buf, sizeof(buf)) > 0) any = true;
+            return any;
+        }
+#endif
+        auto now = std::chrono::steady_clock::now();
+        if (last_size >= 0 && std::chrono::duration<double>(now - last_poll).count() < min_interval) return false;
+        last_poll = now;
+        struct stat st;
+        if (stat(path.c_str(), &st)) return false;
+        int64_t size = static_cast<int64_t>(st.st_size), mtime = static_cast<int64_t>(st.st_mtime);
+        bool any = size != last_size || mtime != last_mtime;
+        last_size = size;
+        last_mtime = mtime;
+        return any;
+    }
+}
@@ -1,20 +1,31 @@
 #include "stdafx.h"
 #include "filterbank.hpp"
 #include "util.hpp"
+#include "threadpool.hpp"
 
 namespace {
     // helpers
-    /* helper for reading one keyword from the header */
-    bool _read_next_header_keyword(std::ifstream & ifs, std::string & kwd, watplot::Filterbank::Header & header)
+    /* longest keyword or string value accepted in a header (anything longer means the file is not a header) */
+    const uint32_t MAX_HEADER_STRING = 1 << 16;
+
+    /* helper for reading one keyword from the header
+     * @return 1 if a keyword was read, 0 at HEADER_START/HEADER_END, -1 if the header is invalid (error is set) */
+    int _read_next_header_keyword(std::ifstream & ifs, std::string & kwd, watplot::Filterbank::Header & header,
+                                  std::string & error)
     {
-        uint32_t kwdlen;
+        uint32_t kwdlen = 0;
         ifs.read((char*)& kwdlen, sizeof(kwdlen));
+        if (!ifs || kwdlen > MAX_HEADER_STRING) {
+            error = "Truncated or invalid header";
+            return -1;
+        }
 
         kwd.resize(kwdlen);
         ifs.read(&kwd[0], kwdlen);
-        if (kwd == "HEADER_START" || kwd == "HEADER_END") return false;
+        if (kwd == "HEADER_START" || kwd == "HEADER_END") return 0;
 
-        char dtype = watplot::consts::HEADER_KEYWORD_TYPES.at(kwd);
+        auto it = watplot::consts::HEADER_KEYWORD_TYPES.find(kwd);
+        char dtype = it == watplot::consts::HEADER_KEYWORD_TYPES.end() ? 0 : it->second;
 
         switch (dtype) {
         case 'l':
@@ -50,8 +61,12 @@ namespace {
         break;
         case 's':
         {
-            uint32_t len;
+            uint32_t len = 0;
             ifs.read((char*)& len, sizeof(len));
+            if (len > MAX_HEADER_STRING) {
+                error = "Truncated or invalid header";
+                return -1;
+            }
             std::string data;
             data.resize(len);
             ifs.read(&data[0], len);
@@ -70,170 +85,233 @@ namespace {
         }
         break;
         default:
-            std::cerr << "Unsupported header keyword: " << kwd << "\n";
-            std::exit(2);
+            error = "Unsupported header keyword: " + kwd;
+            return -1;
         }
-        return true;
+        if (!ifs) {
+            error = "Truncated or invalid header";
+            return -1;
+        }
+        return 1;
     }
 
     /** helper for reading the entire header
-     *  @return position, in bytes, at end of header */
-    int64_t _read_header(std::ifstream & ifs, watplot::Filterbank::Header & header)
+     *  @return position, in bytes, at end of header; -1 if this is not a filterbank file,
+     *          -2 if the header is invalid (error is set) */
+    int64_t _read_header(std::ifstream & ifs, watplot::Filterbank::Header & header, std::string & error)
     {
         std::string keyword;
 
         // check this is a blimpy file
-        if (_read_next_header_keyword(ifs, keyword, header) || keyword != "HEADER_START") {
-            std::cerr << "Not a BLIMPY filterbank file!\n";
-            std::exit(1);
+        if (_read_next_header_keyword(ifs, keyword, header, error) || keyword != "HEADER_START") {
+            error = "Not a BLIMPY filterbank file!";
+            return -1;
         }
-        while (_read_next_header_keyword(ifs, keyword, header)) {
+        int status;
+        while ((status = _read_next_header_keyword(ifs, keyword, header, error)) > 0) {
             // do nothing 
         }
+        if (status < 0) return -2;
 
         return ifs.tellg();
     }
+
+    /** helper for faulting in the pages holding bytes [col_lo, col_lo + col_len) of rows [t_lo, t_hi)
+     *  of mapped data (row_bytes per row), by reading one byte per page */
+    void _touch_pages(const char * data, int64_t t_lo, int64_t t_hi, int64_t row_bytes,
+                      int64_t col_lo, int64_t col_len)
+    {
+        const int64_t PAGE_BYTES = 4096;
+        unsigned char sum = 0;
+        for (int64_t t = t_lo; t < t_hi; ++t) {
+            const char * row = data + t * row_bytes + col_lo;
+            for (int64_t i = 0; i < col_len; i += PAGE_BYTES) sum += row[i];
+            if (col_len) sum += row[col_len - 1];
+        }
+        // keep the reads from being optimized away
+        volatile unsigned char sink = sum;
+        (void)sink;
+    }
 }
 
 
 namespace watplot {
     const std::string Filterbank::FILE_FORMAT_NAME = "Sigproc Filterbank";
+    const int64_t Filterbank::VIEW_BLOCKS_PER_THREAD = 8;
+    const int64_t Filterbank::VIEW_CHUNK_BYTES = 1LL << 26;
+    const int64_t Filterbank::PREFETCH_CHUNKS = 2;
     void Filterbank::_load(const std::string & path) {
         std::ifstream ifs(path, std::ios::in | std::ios::binary);
-        header_end = _read_header(ifs, header);
+        std::string error;
+        header_end = _read_header(ifs, header, error);
+        if (header_end < 0) {
+            // (exit code 1: not a filterbank file, 2: invalid header)
+            std::cerr << error << "\n";
+            std::exit(static_cast<int>(-header_end));
+        }
         data_size_bytes = file_size_bytes - header_end;
 
-        if (header.nbits != 8 && header.nbits != 16 && header.nbits != 32 && header.nbits != 64) {
-            std::cerr << "Error: Unsupported data width: " << header.nbits << " (only 8, 16, 32 bit data supported)\n";
+        if (header.nbits != 1 && header.nbits != 2 && header.nbits != 4 &&
+            header.nbits != 8 && header.nbits != 16 && header.nbits != 32 && header.nbits != 64) {
+            std::cerr << "Error: Unsupported data width: " << header.nbits << " (only 1, 2, 4, 8, 16, 32 bit data supported)\n";
+            std::exit(4);
+        }
+        if (header.nbits < 8 && int64_t(header.nchans) * _nifs() * header.nbits % 8) {
+            // (each spectrum of packed samples must start on a byte)
+            std::cerr << "Error: Spectra of " << header.nchans << " x " << header.nbits <<
+                "-bit samples do not fill whole bytes\n";
             std::exit(4);
         }
     }
 
+    bool Filterbank::read_info(const std::string & path, FileInfo & info) {
+        std::ifstream ifs(path, std::ios::in | std::ios::binary);
+        info.format = FILE_FORMAT_NAME;
+        int64_t end = _read_header(ifs, info.header, info.error);
+        if (end < 0) return false;
+        info.data_size_bytes = info.file_size_bytes - end;
+        return true;
+    }
+
+    void Filterbank::_map_data() {
+        if (!data_map.open(file_path, header_end, data_size_bytes)) {
+            std::cerr << "Fatal error: Could not memory-map data file (" << file_path << ")\n";
+            std::exit(3);
+        }
+    }
+
+    int64_t Filterbank::refresh() {
+        std::unique_lock<std::mutex> lock(data_mtx, std::try_to_lock);
+        if (!lock.owns_lock()) return -1;
+
+        struct stat st;
+        if (stat(file_path.c_str(), &st)) return 0;
+        int64_t row_bytes = int64_t(header.nchans) * _nifs() * header.nbits / 8;
+        int64_t new_nints = (static_cast<int64_t>(st.st_size) - header_end) / row_bytes;
+        if (new_nints <= nints) return 0;
+
+        int64_t n_new = new_nints - nints;
+        file_size_bytes = static_cast<int64_t>(st.st_size);
+        data_size_bytes = file_size_bytes - header_end;
+        _map_data();
+        _append_samples(new_nints);
+        return n_new;
+    }
+
     void Filterbank::_view(const cv::Rect2d & rect, Eigen::MatrixXd & out, int64_t t_lo, int64_t t_hi, int64_t t_step, 
                                                                            int64_t f_lo, int64_t f_hi, int64_t f_step) const
     {
         // REMEMBER: y axis is frequency, x is time
-        std::ifstream ifs(file_path, std::ios::binary | std::ios::in); 
-
         int64_t out_hi = (f_hi - f_lo) / f_step;
-        int64_t out_wid = (t_hi - t_lo) / t_step;
-        int64_t nbytes = header.nbits / 8;
-
-        if (t_lo <= 0 && t_hi >= nints && f_lo <= 0 && f_hi >= header.nchans
-            && f_step == 1 && t_step == 1 && (nbytes == 4 || nbytes == 8)) {
-            // want everything in the file; fast-forward and load the entire file
-            // (only support 32/64-bit)
-            ifs.seekg(header_end);
-            if (nbytes == 4) {
-                Eigen::MatrixXf buf(out_hi, out_wid);
-                ifs.read((char*)buf.data(), out_hi * out_wid * nbytes);
-                for (int64_t i = out.cols() - 2; i > 0; --i) {
-                    for (int64_t j = out.rows() - 2; j > 0; --j) {
-                        out(j, i) = buf(j - 1, i - 1);
-                    }
-                }
-            }
-            else if (nbytes == 8) {
-                ifs.read((char*)out.data(), out_hi * out_wid * nbytes);
-                for (int64_t i = out.cols() - 2; i > 0; --i) {
-                    for (int64_t j = out.rows() - 2; j > 0; --j) {
-                        out(j, i) = out.data()[i * header.nchans + j];
-                    }
-                }
-                out.row(0).setZero();
-                out.col(0).setZero();
-                out.row(out.rows() - 1).setZero();
-                out.col(out.cols() - 1).setZero();
-            }
-        }
-        else {
+        int64_t nbits = header.nbits;
+        // (the spectrum of each time sample holds all IFs, one after another; 1, 2, 4-bit samples are packed)
+        int64_t row_bytes = header.nchans * _nifs() * nbits / 8;
+
+        int64_t maxf = min(f_hi, nchans_shown), maxt = min(t_hi, nints);
 
-            // load the data into bins
+        // the channels to read from each spectrum, and the part of the spectrum they span
+        std::vector<util::ChannelRun> runs = _channel_runs(f_lo, maxf);
+        int64_t col_lo = row_bytes, col_hi = 0, read_bytes = 0;
+        for (const util::ChannelRun & r : runs) {
+            col_lo = min(col_lo, r.src * nbits / 8);
+            col_hi = max(col_hi, ((r.src + r.hi - r.lo) * nbits + 7) / 8);
+            read_bytes += ((r.hi - r.lo) * nbits + 7) / 8;
+        }
+        col_hi = max(col_hi, col_lo);
 
-            int64_t maxf = min(f_hi, header.nchans), maxt = min(t_hi, nints);
+        // hint the OS: reading most of each spectrum is a sequential scan, reading a narrow band is not
+        int64_t span_lo = t_lo * row_bytes, span_len = (maxt - t_lo) * row_bytes;
+        if (read_bytes * 2 >= row_bytes) {
+            data_map.advise(MappedFile::SEQUENTIAL, span_lo, span_len);
+        }
+        else {
+            data_map.advise(MappedFile::RANDOM, span_lo, span_len);
+        }
 
-            {
-                // buffer to load several columns at once
-                int64_t bufsize = min(max((consts::MEMORY / 12), (maxf - f_lo) * nbytes), data_size_bytes + 1);
-                std::string bufs;
-                bufs.resize(bufsize + 1);
-                char * buf = &bufs[0];
-                int64_t last_read_pos = 0;
-
-                // for every timestamp
-                for (int64_t t = t_lo; t < maxt; ++t) {
-                    double * out_data = out.data() + ((t - t_lo) / t_step + 1) * (out_hi + 2) + 1;
+        // load the data into bins, directly from the mapped pages, one chunk of timestamps at a time.
+        // Each block of output columns (time bins) is binned by one thread, from its own range of timestamps,
+        // so threads never write to the same bins
+        out.setZero();
+        const char * data = data_map.data();
+        int64_t report_every = max((maxt - t_lo) / 10, int64_t(1));
+        std::atomic<int64_t> n_loaded(0);
+        std::mutex report_mtx;
+        auto start_time = std::chrono::high_resolution_clock::now();
 
-                    int64_t pos = header_end + (t * header.nchans + f_lo) * nbytes;
-                    int64_t offset = pos - last_read_pos;
-                    // try to use existing buffer if possible
-                    if (!last_read_pos || offset + (maxf - f_lo) * nbytes >= bufsize) {
-                        ifs.seekg(pos);
-                        ifs.read(buf, bufsize);
-                        last_read_pos = pos;
-                        offset = 0;
-                        std::cerr << "Filterbank-view: Data file " << util::round(double(t - t_lo) / maxt * 100, 2) << "% loaded\n";
-                    }
+        // chunks hold a whole number of time bins
+        int64_t chunk_t = max(VIEW_CHUNK_BYTES / max(row_bytes * t_step, int64_t(1)), int64_t(1)) * t_step;
+        int64_t n_chunks = (maxt - t_lo + chunk_t - 1) / chunk_t;
 
-                    int64_t n_f_bins = (maxf - f_lo) / f_step;
-                    int64_t f_xtra_bin_size = (maxf - f_lo) % f_step;
-                    switch (nbytes) {
-                    case 4:
+        // I/O pipeline: while the pool bins chunk k, a prefetch thread faults in the pages of
+        // chunks k + 1 ... k + PREFETCH_CHUNKS, so that reading overlaps with binning
+        std::mutex pf_mtx;
+        std::condition_variable pf_cv;
+        int64_t n_binned = 0;
+        std::thread prefetcher;
+        if (n_chunks > 1) {
+            prefetcher = std::thread([&]() {
+                for (int64_t k = 1; k < n_chunks; ++k) {
                     {
-                        Eigen::Map<Eigen::VectorXd> out_mp(out_data, n_f_bins);
-                        Eigen::Map<Eigen::MatrixXf> in_mp((float*)(buf + offset), f_step, n_f_bins);
-                        out_mp += in_mp.colwise().sum().cast<double>();
-
-                        if (f_xtra_bin_size) {
-                            double * out_mp_xtra = out_data + n_f_bins;
-                            Eigen::Map<Eigen::VectorXf> in_mp_xtra((float*)(buf + offset) + f_step * n_f_bins, f_xtra_bin_size);
-                            *out_mp_xtra += in_mp_xtra.sum();
-                        }
+                        std::unique_lock<std::mutex> lock(pf_mtx);
+                        pf_cv.wait(lock, [&]() { return k - n_binned <= PREFETCH_CHUNKS; });
                     }
-                    break;
+                    int64_t c_lo = t_lo + k * chunk_t, c_hi = min(c_lo + chunk_t, maxt);
+                    data_map.advise(MappedFile::WILLNEED, c_lo * row_bytes, (c_hi - c_lo) * row_bytes);
+                    _touch_pages(data, c_lo, c_hi, row_bytes, col_lo, col_hi - col_lo);
+                }
+            });
+        }
+
+        ThreadPool & pool = ThreadPool::global();
+        for (int64_t k = 0; k < n_chunks; ++k) {
+            int64_t c_lo = t_lo + k * chunk_t, c_hi = min(c_lo + chunk_t, maxt);
+            int64_t n_t_bins = (c_hi - c_lo + t_step - 1) / t_step;
+            int grain = static_cast<int>(max(n_t_bins / (int64_t(pool.size()) * VIEW_BLOCKS_PER_THREAD), int64_t(1)));
+            pool.parallel_for(0, static_cast<int>(n_t_bins), grain, [&](int lo, int hi) {
+                int64_t bt_lo = c_lo + lo * t_step, bt_hi = min(c_lo + hi * t_step, c_hi);
+                for (int64_t t = bt_lo; t < bt_hi; ++t) {
+                    double * out_data = out.data() + ((t - t_lo) / t_step + 1) * (out_hi + 2) + 1;
+                    const char * in = data + t * row_bytes;
+                    switch (nbits) {
+                    case 32:
+                        util::bin_runs<float>(in, runs, f_lo, f_step, out_data);
+                        break;
+                    case 64:
+                        util::bin_runs<double>(in, runs, f_lo, f_step, out_data);
+                        break;
+                    case 16:
+                        util::bin_runs<uint16_t>(in, runs, f_lo, f_step, out_data);
+                        break;
                     case 8:
-                    {
-                        Eigen::Map<Eigen::VectorXd> out_mp(out_data, n_f_bins);
-                        Eigen::Map<Eigen::MatrixXd> in_mp((double*)(buf + offset), f_step, n_f_bins);
-                        out_mp += in_mp.colwise().sum();
-
-                        if (f_xtra_bin_size) {
-                            double * out_mp_xtra = out_data + n_f_bins;
-                            Eigen::Map<Eigen::VectorXd> in_mp_xtra((double*)(buf + offset) + f_step * n_f_bins, f_xtra_bin_size);
-                            *out_mp_xtra += in_mp_xtra.sum();
-                        }
+                        util::bin_runs<uint8_t>(in, runs, f_lo, f_step, out_data, 256.0);
+                        break;
+                    default:
+                        // 1, 2, 4-bit: scaled to the 16-bit range, like 8-bit data
+                        util::bin_runs_packed(in, header.nbits, runs, f_lo, f_step, out_data,
+                                              double(1 << (16 - nbits)));
+                        break;
                     }
-                    break;
-                    case 2:
-                    {
-                        Eigen::Map<Eigen::VectorXd> out_mp(out_data, n_f_bins);
-                        Eigen::Map<Eigen::Matrix<uint16_t, Eigen::Dynamic, Eigen::Dynamic>>
-                            in_mp((uint16_t*)(buf + offset), f_step, n_f_bins);
-                        out_mp += in_mp.colwise().sum().cast<double>();
-
-                        if (f_xtra_bin_size) {
-                            double * out_mp_xtra = out_data + n_f_bins;
-                            Eigen::Map<Eigen::Matrix<uint16_t, Eigen::Dynamic, 1>> in_mp_xtra((uint16_t*)(buf + offset) + f_step * n_f_bins, f_xtra_bin_size);
-                            *out_mp_xtra += static_cast<double>(in_mp_xtra.sum());
-                        }
+                }
 
-                    }
-                    break;
-                    case 1:
-                        Eigen::Map<Eigen::VectorXd> out_mp(out_data, n_f_bins);
-                        Eigen::Map<Eigen::Matrix<uint8_t, Eigen::Dynamic, Eigen::Dynamic>>
-                            in_mp((uint8_t*)(buf + offset), f_step, n_f_bins);
-                        out_mp += in_mp.colwise().sum().cast<double>() * 256;
-
-                        if (f_xtra_bin_size) {
-                            double * out_mp_xtra = out_data + n_f_bins;
-                            Eigen::Map<Eigen::Matrix<uint16_t, Eigen::Dynamic, 1>> in_mp_xtra((uint16_t*)(buf + offset) + f_step * n_f_bins, f_xtra_bin_size);
-                            *out_mp_xtra += static_cast<double>(in_mp_xtra.sum()) * 256;
-                        }
-                    }
+                int64_t before = n_loaded.fetch_add(bt_hi - bt_lo), after = before + bt_hi - bt_lo;
+                if (before / report_every != after / report_every) {
+                    std::lock_guard<std::mutex> lock(report_mtx);
+                    std::cerr << "Filterbank-view: Data file " << util::round(double(after) / (maxt - t_lo) * 100, 2) << "% loaded\n";
                 }
+            });
+
+            {
+                std::lock_guard<std::mutex> lock(pf_mtx);
+                n_binned = k + 1;
             }
+            pf_cv.notify_one();
         }
-        std::cerr << "Filterbank-view: 100% loaded, processing data in memory...\n";
+        if (prefetcher.joinable()) prefetcher.join();
+
+        double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count();
+        double mbytes = double(max(maxt - t_lo, int64_t(0)) * read_bytes) / (1 << 20);
+        std::cerr << "Filterbank-view: 100% loaded (" << util::round(mbytes, 1) << " MB in " <<
+            util::round(elapsed, 3) << " s, " << util::round(mbytes / max(elapsed, 1e-9), 1) <<
+            " MB/s), processing data in memory...\n";
     } 
 }
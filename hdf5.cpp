@@ -1,9 +1,12 @@
 #include "stdafx.h"
 #include "hdf5.hpp"
 #include "util.hpp"
+#include "threadpool.hpp"
 
 namespace {
-    void _read_header(H5::DataSet & ds, watplot::HDF5::Header & header) {
+    /* helper for reading the header attributes of the data set
+     * @return false if there is an unsupported attribute (error is set) */
+    bool _read_header(H5::DataSet & ds, watplot::HDF5::Header & header, std::string & error) {
         using namespace H5;
         using namespace watplot;
 
@@ -11,7 +14,8 @@ namespace {
         for (int i = 1; i < ds.getNumAttrs(); ++i) {
             Attribute attr = ds.openAttribute(i);
             const std::string & kwd = attr.getName();
-            char dtype = consts::HEADER_KEYWORD_TYPES.at(kwd);
+            auto it = consts::HEADER_KEYWORD_TYPES.find(kwd);
+            char dtype = it == consts::HEADER_KEYWORD_TYPES.end() ? 0 : it->second;
             IntType inttype = attr.getIntType();
             FloatType flttype = attr.getFloatType();
             StrType strtype = attr.getStrType();
@@ -70,29 +74,136 @@ namespace {
             }
             break;
             default:
-                std::cerr << "Unsupported header keyword: " << kwd << "\n";
-                std::exit(2);
+                error = "Unsupported header keyword: " + kwd;
+                return false;
             }
 
         }
+        return true;
     }
 
+    /* smallest prime >= x (for the number of chunk cache hash slots) */
+    size_t _next_prime(size_t x) {
+        for (;; ++x) {
+            bool prime = x > 1;
+            for (size_t d = 2; d * d <= x && prime; ++d) {
+                if (x % d == 0) prime = false;
+            }
+            if (prime) return x;
+        }
+    }
+
+    /* the part of each time sample read for a view: IFs [if_lo, if_lo + n_if) x channels [ch_lo, ch_lo + n_ch),
+     * and the runs of shown channels in it (indexed into the spectrum read, IF after IF) */
+    struct ReadRegion {
+        int64_t if_lo, n_if, ch_lo, n_ch;
+        std::vector<watplot::util::ChannelRun> runs;
+    };
+
+    /* helper for finding the smallest region holding runs of channels of a spectrum of all IFs */
+    ReadRegion _read_region(const std::vector<watplot::util::ChannelRun> & runs, int64_t nchans) {
+        ReadRegion reg;
+        int64_t if_hi = 0, ch_hi = 0;
+        reg.if_lo = reg.ch_lo = LLONG_MAX;
+        for (const watplot::util::ChannelRun & r : runs) {
+            int64_t k = r.src / nchans, c = r.src % nchans;
+            reg.if_lo = min(reg.if_lo, k);
+            if_hi = max(if_hi, k + 1);
+            reg.ch_lo = min(reg.ch_lo, c);
+            ch_hi = max(ch_hi, c + r.hi - r.lo);
+        }
+        if (runs.empty()) reg.if_lo = reg.ch_lo = 0;
+        reg.n_if = max(if_hi - reg.if_lo, int64_t(0));
+        reg.n_ch = max(ch_hi - reg.ch_lo, int64_t(0));
+        for (const watplot::util::ChannelRun & r : runs) {
+            reg.runs.push_back(watplot::util::ChannelRun{ r.lo, r.hi,
+                (r.src / nchans - reg.if_lo) * reg.n_ch + r.src % nchans - reg.ch_lo });
+        }
+        return reg;
+    }
+
+    /* bin samples [t_lo, maxt) of the runs of shown channels in reg into out, in bins of f_step shown channels
+     * from f_lo (in the layout of BLFile's _view), reading
+     * blocks of block_t whole time samples (aligned to multiples of block_t) with a single contiguous read each.
+     * The next block is read and decoded on another thread while the current one is binned on the ThreadPool;
+     * only the reads hold library_mtx, so other files can be read while this one is being binned */
+    template<class T>
+    void _bin_blocks(H5::DataSet & dataset, const H5::PredType & type, std::mutex & library_mtx, int64_t block_t,
+                     int64_t t_lo, int64_t maxt, int64_t t_step, const ReadRegion & reg, int64_t f_lo, int64_t f_step,
+                     Eigen::MatrixXd & out) {
+        using namespace watplot;
+        int64_t out_hi = out.rows() - 2;
+        int64_t n_f = reg.n_if * reg.n_ch;
+        int64_t b_lo = t_lo / block_t, b_hi = (maxt + block_t - 1) / block_t;
+        int64_t report_every = max((b_hi - b_lo) / 10, int64_t(1));
+
+        std::vector<T> bufs[2];
+        auto read_block = [&](int64_t b, std::vector<T> * buf) {
+            int64_t r_lo = max(b * block_t, t_lo), r_hi = min((b + 1) * block_t, maxt);
+            buf->resize((r_hi - r_lo) * n_f);
+            std::lock_guard<std::mutex> lock(library_mtx);
+            hsize_t offset[3] = { hsize_t(r_lo), hsize_t(reg.if_lo), hsize_t(reg.ch_lo) };
+            hsize_t count[3] = { hsize_t(r_hi - r_lo), hsize_t(reg.n_if), hsize_t(reg.n_ch) };
+            H5::DataSpace dataspace = dataset.getSpace();
+            dataspace.selectHyperslab(H5S_SELECT_SET, count, offset);
+            H5::DataSpace memspace(3, count);
+            dataset.read(buf->data(), type, memspace, dataspace);
+        };
+
+        ThreadPool & pool = ThreadPool::global();
+        std::future<void> next = std::async(std::launch::async, read_block, b_lo, &bufs[0]);
+        for (int64_t b = b_lo; b < b_hi; ++b) {
+            next.get();
+            const std::vector<T> & buf = bufs[(b - b_lo) & 1];
+            if (b + 1 < b_hi) {
+                next = std::async(std::launch::async, read_block, b + 1, &bufs[(b + 1 - b_lo) & 1]);
+            }
+
+            // bin the block, in parallel over output columns (time bins)
+            int64_t r_lo = max(b * block_t, t_lo), r_hi = min((b + 1) * block_t, maxt);
+            int c_lo = static_cast<int>((r_lo - t_lo) / t_step), c_hi = static_cast<int>((r_hi - 1 - t_lo) / t_step + 1);
+            pool.parallel_for(c_lo, c_hi, 1, [&](int lo, int hi) {
+                int64_t t_end = min(t_lo + hi * t_step, r_hi);
+                for (int64_t t = max(t_lo + lo * t_step, r_lo); t < t_end; ++t) {
+                    double * out_data = out.data() + ((t - t_lo) / t_step + 1) * (out_hi + 2) + 1;
+                    util::bin_runs<T>(reinterpret_cast<const char *>(buf.data() + (t - r_lo) * n_f), reg.runs,
+                                      f_lo, f_step, out_data);
+                }
+            });
+
+            if ((b - b_lo + 1) % report_every == 0) {
+                std::cerr << "HDF5-view: Data file " << util::round(double(b - b_lo + 1) / (b_hi - b_lo) * 100, 2) <<
+                    "% loaded\n";
+            }
+        }
+    }
 }
 
 namespace watplot {
     const std::string HDF5::FILE_FORMAT_NAME = "HDF5";
     const std::string HDF5::DATASET_SUBSET_NAME = "data";
+    const int64_t HDF5::VIEW_BLOCK_BYTES = 1LL << 26;
+    const int64_t HDF5::MAX_CHUNK_CACHE_BYTES = 1LL << 28;
+
+    std::mutex HDF5::library_mtx;
 
     void HDF5::_load(const std::string & path) {
+        std::lock_guard<std::mutex> lock(library_mtx);
         H5::H5File file = H5::H5File(path, H5F_ACC_RDONLY);
         H5::DataSet dataset = file.openDataSet(DATASET_SUBSET_NAME);
         data_size_bytes = dataset.getStorageSize();
-        _read_header(dataset, header);
+        std::string error;
+        if (!_read_header(dataset, header, error)) {
+            std::cerr << error << "\n";
+            std::exit(2);
+        }
 
         H5::DataSpace dataspace = dataset.getSpace();
         hsize_t dims_out[3];
         dataspace.getSimpleExtentDims(dims_out, NULL);
         nints = dims_out[0];
+        // (the data set's shape is time x IF x frequency)
+        if (header.nifs < 1) header.nifs = static_cast<int>(dims_out[1]);
 
         if (header.nbits != 8 && header.nbits != 16 && header.nbits != 32 && header.nbits != 64) {
             std::cerr << "Error: Unsupported data width: " << header.nbits << " (only 8, 16, 32 bit data supported)\n";
@@ -100,76 +211,112 @@ namespace watplot {
         }
     }
 
+    bool HDF5::read_info(const std::string & path, FileInfo & info) {
+        info.format = FILE_FORMAT_NAME;
+        std::lock_guard<std::mutex> lock(library_mtx);
+        try {
+            H5::H5File file = H5::H5File(path, H5F_ACC_RDONLY);
+            H5::DataSet dataset = file.openDataSet(DATASET_SUBSET_NAME);
+            info.data_size_bytes = dataset.getStorageSize();
+            if (!_read_header(dataset, info.header, info.error)) return false;
+
+            H5::DataSpace dataspace = dataset.getSpace();
+            if (dataspace.getSimpleExtentNdims() != 3) {
+                info.error = "Data set is not 3-dimensional (time x IF x frequency)";
+                return false;
+            }
+            hsize_t dims_out[3];
+            dataspace.getSimpleExtentDims(dims_out, NULL);
+            info.nints = dims_out[0];
+            if (info.header.nifs < 1) info.header.nifs = static_cast<int>(dims_out[1]);
+        }
+        catch (const H5::Exception & e) {
+            info.error = e.getDetailMsg();
+            return false;
+        }
+        return true;
+    }
+
+    void HDF5::_open_data() const {
+        struct stat st;
+        int64_t mtime = stat(file_path.c_str(), &st) ? -1 : static_cast<int64_t>(st.st_mtime);
+        if (data_file.getId() > 0 && mtime == data_mtime) return;
+        if (data_file.getId() > 0) {
+            std::cerr << "HDF5: File modified, reopening " << file_path << "\n";
+        }
+        data_mtime = mtime;
+        data_file.close();
+        data_file.openFile(file_path, H5F_ACC_RDONLY);
+        H5::DataSet dataset = data_file.openDataSet(DATASET_SUBSET_NAME);
+
+        // chunk layout (a contiguous dataset is treated as having chunks of one whole spectrum)
+        hsize_t chunk[3] = { 1, 1, hsize_t(header.nchans) };
+        H5::DSetCreatPropList dcpl = dataset.getCreatePlist();
+        if (dcpl.getLayout() == H5D_CHUNKED) {
+            dcpl.getChunk(3, chunk);
+        }
+        chunk_t = static_cast<int64_t>(chunk[0]);
+        chunk_f = static_cast<int64_t>(chunk[2]);
+        int64_t chunk_bytes = chunk_t * static_cast<int64_t>(chunk[1]) * chunk_f * (header.nbits / 8);
+
+        // size the chunk cache to hold a row of chunks across all channels (of all IFs), so that chunks shared by
+        // consecutive reads (e.g. neighbouring tiles) are not decoded again
+        int64_t chunk_if = max(static_cast<int64_t>(chunk[1]), int64_t(1));
+        int64_t n_chunks = (header.nchans + chunk_f - 1) / chunk_f * ((_nifs() + chunk_if - 1) / chunk_if);
+        int64_t cache_bytes = min(n_chunks * chunk_bytes, MAX_CHUNK_CACHE_BYTES);
+        int64_t cache_chunks = max(cache_bytes / max(chunk_bytes, int64_t(1)), int64_t(1));
+        H5::DSetAccPropList dapl;
+        // (HDF5 recommends about 100 hash slots per cached chunk, a prime number of them; and w0 = 1,
+        //  since each chunk is read in full)
+        dapl.setChunkCache(_next_prime(static_cast<size_t>(cache_chunks * 100)), static_cast<size_t>(cache_bytes), 1.0);
+        dataset.close();
+        data_set = data_file.openDataSet(DATASET_SUBSET_NAME, dapl);
+
+        std::cerr << "HDF5: Opened " << file_path << " (chunks of " << chunk_t << " x " << chunk_f << " samples, " <<
+            cache_bytes / (1 << 20) << " MB chunk cache)\n";
+    }
+
     void HDF5::_view(const cv::Rect2d & rect, Eigen::MatrixXd & out, int64_t t_lo, int64_t t_hi, int64_t t_step,
                                                                      int64_t f_lo, int64_t f_hi, int64_t f_step) const {
-        // load the data int64_to bins
-        H5::H5File file = H5::H5File(file_path, H5F_ACC_RDONLY);
-        H5::DataSet dataset = file.openDataSet(DATASET_SUBSET_NAME);
+        // load the data into bins, through the persistent handles (calls into the library one thread at a time)
+        {
+            std::lock_guard<std::mutex> lock(library_mtx);
+            _open_data();
+        }
 
-        int64_t out_hi = (f_hi - f_lo) / f_step;
-        //int64_t out_wid = (t_hi - t_lo) / t_step;
+        int64_t maxf = min(f_hi, nchans_shown), maxt = min(t_hi, nints);
+        int64_t nbytes = (header.nbits / 8);
 
-        int64_t maxf = min(f_hi, header.nchans), maxt = min(t_hi, nints);
+        // only the IFs shown are read (e.g. 2 of the 4 of full-Stokes data)
+        ReadRegion reg = _read_region(_channel_runs(f_lo, maxf), header.nchans);
 
-        int64_t nbytes = (header.nbits / 8);
-        H5::DataSpace dataspace = dataset.getSpace();
+        // read whole rows of chunks at a time, so that each chunk is decoded exactly once
+        int64_t n_f = reg.n_if * reg.n_ch;
+        int64_t block_t = chunk_t * max(VIEW_BLOCK_BYTES / max(chunk_t * n_f * nbytes, int64_t(1)), int64_t(1));
 
-        hsize_t offset[3] = { hsize_t(t_lo), 0, hsize_t(f_lo) };
-        hsize_t stride[3] = { hsize_t(t_step), 1, hsize_t(f_step) };
-        hsize_t count[3] = { hsize_t(maxt - t_lo) / stride[0], 1, hsize_t(maxf - f_lo) / stride[2] };
-        dataspace.selectHyperslab(H5S_SELECT_SET, count, offset, stride);
-
-        hsize_t mem_count[2] = { count[0], count[2] };
-        H5::DataSpace memspace(2, mem_count);
-
-        std::cerr << "HDF5-view: Reading data...\n";
-        if (nbytes == 4) {
-            Eigen::MatrixXf buf(count[2], count[0]);
-            dataset.read(buf.data(), H5::PredType::NATIVE_FLOAT, memspace, dataspace);
-            std::cerr << "HDF5-view: Copying from buffer...\n";
-            for (int64_t i = out.cols() - 2; i > 0; --i) {
-                for (int64_t j = out.rows() - 2; j > 0; --j) {
-                    out(j, i) = static_cast<double>(buf(j - 1, i - 1));
-                }
+        std::cerr << "HDF5-view: Reading data (chunks of " << chunk_t << " x " << chunk_f << " samples, " <<
+            block_t << " time samples per read)...\n";
+        // bins past the end of the data stay zero
+        out.setZero();
+        if (maxt > t_lo && n_f > 0) {
+            if (nbytes == 4) {
+                _bin_blocks<float>(data_set, H5::PredType::NATIVE_FLOAT, library_mtx, block_t,
+                                   t_lo, maxt, t_step, reg, f_lo, f_step, out);
             }
-        }
-        else if (nbytes == 8) {
-            Eigen::MatrixXd buf(count[2], count[0]);
-            dataset.read(buf.data(), H5::PredType::NATIVE_DOUBLE, memspace, dataspace);
-            std::cerr << "HDF5-view: Copying from buffer...\n";
-            for (int64_t i = out.cols() - 2; i > 0; --i) {
-                for (int64_t j = out.rows() - 2; j > 0; --j) {
-                    out(j, i) = buf(j - 1, i - 1);
-                }
+            else if (nbytes == 8) {
+                _bin_blocks<double>(data_set, H5::PredType::NATIVE_DOUBLE, library_mtx, block_t,
+                                    t_lo, maxt, t_step, reg, f_lo, f_step, out);
             }
-        }
-        else if (nbytes == 2) {
-            Eigen::Matrix<uint16_t, Eigen::Dynamic, 1> buf(count[2], count[0]);
-            dataset.read(buf.data(), H5::PredType::NATIVE_UINT16, memspace, dataspace);
-            std::cerr << "HDF5-view: Copying from buffer...\n";
-            for (int64_t i = out.cols() - 2; i > 0; --i) {
-                for (int64_t j = out.rows() - 2; j > 0; --j) {
-                    out(j, i) = static_cast<double>(buf(j - 1, i - 1));
-                }
+            else if (nbytes == 2) {
+                _bin_blocks<uint16_t>(data_set, H5::PredType::NATIVE_UINT16, library_mtx, block_t,
+                                      t_lo, maxt, t_step, reg, f_lo, f_step, out);
             }
-        }
-        else if (nbytes == 1) {
-            Eigen::Matrix<uint16_t, Eigen::Dynamic, 1>  buf(count[2], count[0]);
-            dataset.read(buf.data(), H5::PredType::NATIVE_UINT8, memspace, dataspace);
-            std::cerr << "HDF5-view: Copying from buffer...\n";
-            for (int64_t i = out.cols() - 2; i > 0; --i) {
-                for (int64_t j = out.rows() - 2; j > 0; --j) {
-                    out(j, i) = static_cast<double>(buf(j - 1, i - 1));
-                }
+            else if (nbytes == 1) {
+                _bin_blocks<uint8_t>(data_set, H5::PredType::NATIVE_UINT8, library_mtx, block_t,
+                                     t_lo, maxt, t_step, reg, f_lo, f_step, out);
             }
         }
 
-        out *= static_cast<double>(t_step * f_step);
-        out.row(0).setZero();
-        out.col(0).setZero();
-        out.row(out.rows() - 1).setZero();
-        out.col(out.cols() - 1).setZero();
-
         std::cerr << "HDF5-view: 100% loaded, processing data in memory...\n";
     }
 }
@@ -0,0 +1,138 @@
+#pragma once
+#include<cmath>
+#include<cstdint>
+#include<vector>
+#include<algorithm>
+
+namespace watplot {
+    /** Evenly spaced axis of a data file (frequency or time): sample i, in file order, is at start + step * i.
+     *  May be made piecewise evenly spaced by adding segments, each starting at a given sample with its own start
+     *  position (e.g. the scans of a stitched file, separated by gaps).
+     *  Maps positions to sample indices in constant time (logarithmic in the number of segments),
+     *  without storing the positions.
+     *  Unless noted, indices are in increasing order of position (i.e. reversed from file order if step < 0),
+     *  as on the plot */
+    class Axis {
+    public:
+        Axis() { }
+
+        /** n samples, the first (in file order) at start, spaced by step (negative if decreasing) */
+        Axis(double start, double step, int64_t n) : first(start), spacing(step), n(n) { }
+
+        /** From the sample with file order index offset on (past the previous segment's samples), samples are
+         *  at start + step * (i - offset). Segments must be added in increasing order of offset, and keep
+         *  positions monotonic: start must be past the position of sample offset - 1 of the previous segment */
+        inline void add_segment(int64_t offset, double start) {
+            segments.push_back(Segment{ offset, start });
+        }
+
+        /** Number of samples */
+        inline int64_t size() const {
+            return n;
+        }
+
+        inline bool empty() const {
+            return n <= 0;
+        }
+
+        /** Position of the sample with file order index i (may be outside of [0, size())) */
+        inline double position(int64_t i) const {
+            if (segments.empty() || i < segments.front().offset) return first + spacing * i;
+            const Segment & seg = *(std::upper_bound(segments.begin(), segments.end(), i,
+                [](int64_t x, const Segment & g) { return x < g.offset; }) - 1);
+            return seg.start + spacing * (i - seg.offset);
+        }
+
+        /** Position of the k-th lowest sample */
+        inline double at(int64_t k) const {
+            return position(spacing < 0 ? n - 1 - k : k);
+        }
+
+        /** Lowest, highest sample position */
+        inline double front() const {
+            return at(0);
+        }
+        inline double back() const {
+            return at(n - 1);
+        }
+
+        /** Distance between neighbouring samples */
+        inline double step() const {
+            return std::fabs(spacing);
+        }
+
+        /** Lower edge and length of the range covered by the samples [lo, hi) in file order, each step() long,
+         *  including any gaps between segments */
+        inline double lower(int64_t lo, int64_t hi) const {
+            double a = position(lo), b = position(hi);
+            return a < b ? a : b;
+        }
+        inline double length(int64_t lo, int64_t hi) const {
+            return segments.empty() ? step() * (hi - lo) : std::fabs(position(hi) - position(lo));
+        }
+
+        /** Lower edge and length of the range covered by all samples (this is the data rectangle shown on the plot) */
+        inline double lower() const {
+            return lower(0, n);
+        }
+        inline double length() const {
+            return length(0, n);
+        }
+
+        /** Number of samples at positions <= x (same as std::upper_bound over the sorted positions) */
+        int64_t upper_bound(double x) const {
+            if (n <= 0) return 0;
+            double q;
+            if (spacing == 0) q = x >= front() ? n : 0;
+            else if (segments.empty()) q = std::floor((x - front()) / step()) + 1;
+            else {
+                // samples on either side of x, from its fractional file order index
+                double i = _index(x);
+                q = spacing > 0 ? std::floor(i) + 1 : n - std::ceil(i);
+            }
+            // (also if x is NAN)
+            if (!(q > 0)) q = 0;
+            int64_t k = q < n ? static_cast<int64_t>(q) : n;
+            // the division may be off by one at a sample's position
+            while (k > 0 && at(k - 1) > x) --k;
+            while (k < n && at(k) <= x) ++k;
+            return k;
+        }
+
+        /** Number of samples in file order at positions <= x (for increasing axes), counting samples
+         *  past the end of the axis as if it continued (e.g. for data still being appended) */
+        inline int64_t upper_bound_extended(double x) const {
+            return static_cast<int64_t>(std::floor(_index(x))) + 1;
+        }
+
+        /** Change the number of samples (e.g. after samples are appended) */
+        inline void resize(int64_t new_n) {
+            n = new_n;
+        }
+
+    private:
+        /* samples from file order index offset on are at start + spacing * (i - offset) */
+        struct Segment {
+            int64_t offset;
+            double start;
+        };
+
+        /* fractional file order index at which position x falls, in the segment holding x */
+        double _index(double x) const {
+            // segments are in increasing order of position if spacing > 0, otherwise decreasing
+            auto it = std::upper_bound(segments.begin(), segments.end(), x, [this](double v, const Segment & g) {
+                return spacing > 0 ? v < g.start : v > g.start;
+            });
+            if (it == segments.begin()) return (x - first) / spacing;
+            --it;
+            return it->offset + (x - it->start) / spacing;
+        }
+
+        /* position of the first sample in file order, signed spacing, number of samples */
+        double first = 0.0, spacing = 1.0;
+        int64_t n = 0;
+
+        /* segments after the first (which starts at sample 0, at 'first'), in increasing order of offset */
+        std::vector<Segment> segments;
+    };
+}
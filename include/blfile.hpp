@@ -1,11 +1,100 @@
 #pragma once
 #include<string>
 #include<vector>
+#include "axis.hpp"
+#include "pyramid.hpp"
+#include "tilecache.hpp"
+#include "util.hpp"
+#include "viewtable.hpp"
 
 namespace watplot {
+    /** Sigproc filterbank header fields; not filled fields are:
+      * 0 for telescope/machine id, -1 for other ints, empty strings, NAN floats */
+    struct FileHeader {
+        // telescope: 0 = fake data; 1 = Arecibo; 2 = Ooty... others to be added
+        int telescope_id = 0;
+        // machine: 0=FAKE; 1=PSPM; 2=WAPP; 3=OOTY... others to be added
+        int machine_id = 0;
+        // data type: 1=blimpy; 2=time series... others to be added
+        int data_type = -1;
+        // the name of the original data file
+        std::string rawdatafile;
+        // the name of the source being observed by the telescope
+        std::string source_name;
+        // true if data are barycentric or 0 otherwise
+        bool barycentric = 0;
+        // true if data are pulsarcentric or 0 otherwise
+        bool pulsarcentric = 0;
+        // telescope azimuth at start of scan (degrees)
+        double az_start = NAN;
+        // telescope zenith angle at start of scan (degrees)
+        double za_start = NAN;
+        // right ascension (J2000) of source (hours, converted from hhmmss.s)
+        double src_raj = NAN;
+        // declination (J2000) of source (degrees, converted from ddmmss.s)
+        double src_dej = NAN;
+        // time stamp (MJD) of first sample
+        double tstart = NAN;
+        // time interval between samples (s)
+        double tsamp = NAN;
+        // number of bits per time sample
+        int nbits = -1;
+        // number of time samples in the data file (rarely used any more)
+        int nsamples = -1;
+        // centre frequency (MHz) of first blimpy channel
+        double fch1 = NAN;
+        // blimpy channel bandwidth (MHz)
+        double foff = NAN;
+        // number of blimpy channels
+        int nchans = -1;
+        // number of seperate IF channels
+        int nifs = -1;
+        // reference dispersion measure (pc/cm**3)
+        double refdm = NAN;
+        // folding period (s)
+        double period = NAN;
+        //total number of beams (?)
+        int nbeams = -1;
+        // number of the beam in this file (?)
+        int ibeam = -1;
+    };
+
+    /** Which IFs (e.g. polarizations) of a data file with several (header nifs > 1) are shown */
+    struct IFSelection {
+        /** bit k set: IF k is shown (e.g. 1: IF 0 only; 3: IFs 0 and 1) */
+        uint32_t mask = 1;
+
+        /** if false, the IFs shown are added up into each sample (e.g. Stokes I from XX + YY);
+         *  if true, they are shown one after another along the frequency axis, each nchans channels wide */
+        bool side_by_side = false;
+
+        /** Number of IFs shown */
+        inline int count() const {
+            int n = 0;
+            for (uint32_t m = mask; m; m &= m - 1) ++n;
+            return n;
+        }
+
+        /** Description, e.g. "0+1" (added up) or "0,1" (side by side) */
+        std::string name() const {
+            std::string str;
+            for (int k = 0; k < 32; ++k) {
+                if (!(mask >> k & 1)) continue;
+                if (!str.empty()) str += side_by_side ? "," : "+";
+                str += std::to_string(k);
+            }
+            return str;
+        }
+
+        /** Appended to the names of caches of the binned data (empty for IF 0 alone, the default) */
+        inline std::string suffix() const {
+            return mask == 1 ? "" : ".if" + name();
+        }
+    };
+
     /** Base class for all Breakthrough Listen data file formats
      *  Note: do not actually instantiate this class
-     *  Child classes must implement: _load, _view, _file_format */
+     *  Child classes must implement: _load (unless using the default constructor), _view, _file_format */
     template <class ImplType>
     class BLFile {
     public:
@@ -21,27 +110,7 @@ namespace watplot {
             in.close();
 
             static_cast<ImplType *>(this)->_load(path);
-
-            // precompute axes, rectangle
-            if (~header.nchans) {
-                if (~nints) nints = data_size_bytes / (header.nbits / 8) / header.nchans;
-                data_rect.y = min(header.fch1, header.fch1 + header.foff * header.nchans);
-                data_rect.x = min(header.tstart, header.tstart + header.tsamp * nints);
-                data_rect.height = fabs(header.foff) * header.nchans;
-                data_rect.width = fabs(header.tsamp) * nints;
-                freqs.reserve(header.nchans);
-                for (int i = 0; i < header.nchans; ++i) {
-                    freqs.push_back(header.fch1 + header.foff * i);
-                }
-
-                timestamps.reserve(nints);
-                for (int i = 0; i < nints; ++i) {
-                    timestamps.push_back(header.tstart + header.tsamp * i);
-                }
-
-                if (header.foff < 0) std::reverse(freqs.begin(), freqs.end());
-                if (header.tsamp < 0) std::reverse(timestamps.begin(), timestamps.end());
-            }
+            _init_axes();
 
             std::cerr << *this;
         }
@@ -53,22 +122,26 @@ namespace watplot {
          *  Also note: lower bounds should be inclusive, upper should be exclusive
          * @param[in] max_wid max pixels returned width-wise
          * @param[in] max_hi max pixels returned height-wise
-         * @param[out] out prefix-sum matrix. Sum in rectangle (x, y, w, h) may be computed as
+         * @param[in] cache if given, binned data is assembled from (and added to) this tile cache;
+         *                  steps are then rounded up to powers of two so that tiles are shared between views
+         *                  (if the cache is aborted, see TileCache::set_abort, out is left incomplete)
+         * @param[out] out prefix-sum table (in out's storage type). Sum in rectangle (x, y, w, h) may be computed as
          *                 (M[x+w,y+h] - M[x,y+h] - M[x+w,y] + M[x,y])/(wh)
          *                 padded with one row, one column on each side.
          * @return actual rectangle returned. May be rounded.
          */
-        cv::Rect2d view(const cv::Rect2d & rect, Eigen::MatrixXd & out, int max_wid, int max_hi) const {
+        cv::Rect2d view(const cv::Rect2d & rect, ViewTable & out, int max_wid, int max_hi,
+                        TileCache * cache = nullptr) const {
+            std::lock_guard<std::mutex> lock(data_mtx);
             // convert to array indices
-            int64_t f_lo = static_cast<int64_t>(std::upper_bound(freqs.begin(), freqs.end(), rect.y) - freqs.begin()) - 1;
-            f_lo = max(0LL, f_lo);
-            int64_t f_hi = static_cast<int64_t>(std::upper_bound(freqs.begin(), freqs.end(), rect.y + rect.height)
-                - freqs.begin());
-            int64_t t_lo = static_cast<int64_t>(std::upper_bound(timestamps.begin(), timestamps.end(), rect.x)
-                - timestamps.begin()) - 1;
-            t_lo = max(0LL, t_lo);
-            int64_t t_hi = static_cast<int64_t>(std::upper_bound(timestamps.begin(), timestamps.end(), rect.x + rect.width)
-                - timestamps.begin());
+            int64_t f_lo = max(0LL, freqs.upper_bound(rect.y) - 1);
+            int64_t f_hi = freqs.upper_bound(rect.y + rect.height);
+            int64_t t_lo = max(0LL, timestamps.upper_bound(rect.x) - 1);
+            int64_t t_hi = timestamps.upper_bound(rect.x + rect.width);
+            if (tail_mode && header.tsamp > 0 && t_hi >= nints) {
+                // leave room past the end of the data for samples appended later (see extend_view)
+                t_hi = max(t_hi, timestamps.upper_bound_extended(rect.x + rect.width));
+            }
             int64_t f_step = max((f_hi - f_lo - 1) / max_hi + 1, 1LL);
             int64_t t_step = max((t_hi - t_lo - 1) / max_wid + 1, 1LL);
             std::cerr << "BLFile-view: Reloading data file, with t_step=" << t_step << " f_step=" << f_step << " t=[" <<
@@ -76,8 +149,8 @@ namespace watplot {
 
             // swap if step is reversed in input data file
             if (header.foff < 0) {
-                f_lo = header.nchans - f_lo;
-                f_hi = header.nchans - f_hi;
+                f_lo = nchans_shown - f_lo;
+                f_hi = nchans_shown - f_hi;
                 std::swap(f_lo, f_hi);
                 f_lo = max(0LL, f_lo);
             }
@@ -87,6 +160,32 @@ namespace watplot {
                 std::swap(t_lo, t_hi);
             }
 
+            int level = -1;
+            if (cache) {
+                // tiles: power-of-two steps, with lower bounds aligned to the steps
+                t_step = _next_pow2(t_step);
+                f_step = _next_pow2(f_step);
+                // aligning the lower bounds may add a bin, in which case the step is doubled
+                while ((t_hi - (t_lo - t_lo % t_step) - 1) / t_step + 1 > max_wid) t_step *= 2;
+                while ((f_hi - (f_lo - f_lo % f_step) - 1) / f_step + 1 > max_hi) f_step *= 2;
+                t_lo -= t_lo % t_step;
+                f_lo -= f_lo % f_step;
+            }
+            else if (~(level = _pyramid_level(t_step, f_step))) {
+                // use the coarsest pyramid level that still meets the requested resolution;
+                // steps and lower bounds are then aligned to the level's blocks
+                const Pyramid::Level & lv = pyramid.level(level);
+                t_step = (t_step + lv.fac_t - 1) / lv.fac_t * lv.fac_t;
+                f_step = (f_step + lv.fac_f - 1) / lv.fac_f * lv.fac_f;
+                t_lo -= t_lo % lv.fac_t;
+                f_lo -= f_lo % lv.fac_f;
+                // aligning the lower bounds may have added a bin
+                if ((t_hi - t_lo - 1) / t_step + 1 > max_wid) t_step += lv.fac_t;
+                if ((f_hi - f_lo - 1) / f_step + 1 > max_hi) f_step += lv.fac_f;
+                std::cerr << "BLFile-view: Using pyramid level " << level << ", with t_step=" << t_step <<
+                    " f_step=" << f_step << "\n";
+            }
+
             // round to multiple of step size
             f_hi += (f_step - (f_hi - f_lo) % f_step) % f_step;
             t_hi += (t_step - (t_hi - t_lo) % t_step) % t_step;
@@ -95,46 +194,90 @@ namespace watplot {
             int64_t out_hi = (f_hi - f_lo) / f_step;
             int64_t out_wid = (t_hi - t_lo) / t_step;
 
-            // allocate memory
-            out.resize(out_hi + 2, out_wid + 2);
+            out.begin(out_hi + 2, out_wid + 2);
+            out.source.t_lo = t_lo;
+            out.source.t_step = t_step;
+            out.source.f_lo = f_lo;
+            out.source.f_hi = f_hi;
+            out.source.f_step = f_step;
+            std::vector<double> col(out_hi + 2, 0.0);
+            out.push_column(col.data(), double(f_step * t_step));
+
+            // if time increases along the file, only the columns holding data are added (the rest read as empty),
+            // so that samples appended to the file later can be added by extend_view
+            int64_t n_cols = out_wid;
+            if (header.tsamp > 0) n_cols = min(max((nints - t_lo + t_step - 1) / t_step, 0LL), out_wid);
+            if (cache) cache->set_extent(nints);
+            _push_bins(out, 0, n_cols, cache);
+
+            return cv::Rect2d(timestamps.lower(t_lo, t_hi), freqs.lower(f_lo, f_hi),
+                              timestamps.length(t_lo, t_hi), freqs.length(f_lo, f_hi));
+        }
 
-            // call viewer implementation 
-            static_cast<const ImplType *>(this)->_view(rect, out, t_lo, t_hi, t_step, f_lo, f_hi, f_step);
+        /** Add the samples appended to the data file since a table was built by view()
+         *  (after refresh() in the implementation), binning only the new samples.
+         *  Only possible if time increases along the file (tsamp > 0); must be called from the thread
+         *  which calls refresh()
+         * @return true if samples were added */
+        bool extend_view(ViewTable & out) const {
+            const ViewTable::Source & src = out.source;
+            int64_t t_end = min(nints, src.t_lo + (out.cols() - 2) * src.t_step);
+            if (header.tsamp < 0 || out.filled() == 0 || t_end <= max(src.t_end, src.t_lo)) return false;
+
+            // the last column added may have been incomplete, in which case it is replaced
+            out.rewind();
+            _push_bins(out, out.filled() - 1, (t_end - src.t_lo + src.t_step - 1) / src.t_step, nullptr);
+            return true;
+        }
 
-            // reverse cols/rows if frequency/time axis is reversed
-            if (header.foff < 0) {
-                out.colwise().reverseInPlace();
+        /** Compute binned sums of the samples [t_lo, t_hi) x [f_lo, f_hi), in file order indices
+         *  (i.e. before reversing negative foff/tsamp), from the pyramid if an aligned level exists,
+         *  otherwise from the data file.
+         * @param[out] out binned sums, bin (f, t) at out(f + 1, t + 1); must already be sized
+         *                 ((f_hi - f_lo) / f_step + 2, (t_hi - t_lo) / t_step + 2) */
+        void bin(Eigen::MatrixXd & out, int64_t t_lo, int64_t t_hi, int64_t t_step,
+                 int64_t f_lo, int64_t f_hi, int64_t f_step) const {
+            if (t_lo >= nints || f_lo >= nchans_shown) {
+                // entirely outside of the data
+                out.setZero();
+                return;
             }
-            if (header.tsamp < 0) {
-                out.rowwise().reverseInPlace();
+            _pyramid_level(t_step, f_step);
+            int level = pyramid.is_open() ? pyramid.find_aligned_level(t_lo, t_step, f_lo, f_step) : -1;
+            if (~level) {
+                pyramid.view(level, out, t_lo, t_hi, t_step, f_lo, f_hi, f_step);
             }
-
-            // now compute prefix sum matrix from binned matrix
-            // sum columns
-            double * out_data = out.data() + out_hi + 2;
-            for (int64_t t = 0; t <= out_wid; ++t) {
-                std::partial_sum(out_data + t * (out_hi + 2),
-                    out_data + (t + 1) * (out_hi + 2),
-                    out_data + t * (out_hi + 2));
+            else {
+                static_cast<const ImplType *>(this)->_view(data_rect, out, t_lo, t_hi, t_step, f_lo, f_hi, f_step);
             }
+        }
 
-            double area = double(f_step * t_step);
-            out /= area;
-
-            // sum column sums
-            out_data = out.data() + (out_hi + 2) * 2;
-            for (int64_t t = 1; t <= out_wid; ++t) {
-                ++out_data;
-                for (int64_t f = 0; f <= out_hi; ++f) {
-                    *out_data += *(out_data - out_hi - 2);
-                    ++out_data;
-                }
-            }
+        /** Identifies the data by file name, size and modification time
+         *  (e.g. to key caches kept across sessions, see TileStore) */
+        std::string data_id() const {
+            return _file_id(file_path) + ifs.suffix();
+        }
 
-            return cv::Rect2d(
-                min(header.tstart + t_lo * header.tsamp, header.tstart + t_hi * header.tsamp),
-                min(header.fch1 + f_lo * header.foff, header.fch1 + f_hi * header.foff),
-                (t_hi - t_lo) * fabs(header.tsamp), (f_hi - f_lo) * fabs(header.foff));
+        /** Choose the IFs shown (for files with several IFs, e.g. polarizations); bits of IFs the file does not
+         *  have are ignored if all bits are set. Call before building views */
+        void select_ifs(IFSelection sel) {
+            int64_t n_ifs = _nifs();
+            uint32_t valid = n_ifs >= 32 ? ~0u : (1u << n_ifs) - 1;
+            if ((sel.mask != ~0u && (sel.mask & ~valid)) || !(sel.mask & valid)) {
+                std::cerr << "Error: IF selection " << sel.name() << " is out of range (" << file_path << " has " <<
+                    n_ifs << " IFs)\n";
+                std::exit(8);
+            }
+            sel.mask &= valid;
+            ifs = sel;
+            static_cast<ImplType *>(this)->_select_ifs();
+            _init_axes();
+
+            // the overview pyramid (of the IFs shown before) is opened again on the next zoomed-out view
+            pyramid.close();
+            pyramid_checked = false;
+            std::cerr << "BLFile: Showing IF" << (ifs.count() > 1 ? "s " : " ") << ifs.name() <<
+                (ifs.count() > 1 ? (ifs.side_by_side ? " side by side" : " added up") : "") << "\n";
         }
 
         /* Get the file format name (e.g. sigproc filterbank) */
@@ -147,56 +290,8 @@ namespace watplot {
             return consts::TELESCOPES[header.telescope_id];
         }
 
-        /** Sigproc filterbank header fields; not filled fields are:
-          * 0 for telescope/machine id, -1 for other ints, empty strings, NAN floats */
-        struct Header {
-            // telescope: 0 = fake data; 1 = Arecibo; 2 = Ooty... others to be added
-            int telescope_id = 0;
-            // machine: 0=FAKE; 1=PSPM; 2=WAPP; 3=OOTY... others to be added
-            int machine_id = 0;
-            // data type: 1=blimpy; 2=time series... others to be added
-            int data_type = -1;
-            // the name of the original data file
-            std::string rawdatafile;
-            // the name of the source being observed by the telescope
-            std::string source_name;
-            // true if data are barycentric or 0 otherwise
-            bool barycentric = 0;
-            // true if data are pulsarcentric or 0 otherwise
-            bool pulsarcentric = 0;
-            // telescope azimuth at start of scan (degrees)
-            double az_start = NAN;
-            // telescope zenith angle at start of scan (degrees)
-            double za_start = NAN;
-            // right ascension (J2000) of source (hours, converted from hhmmss.s)
-            double src_raj = NAN;
-            // declination (J2000) of source (degrees, converted from ddmmss.s)
-            double src_dej = NAN;
-            // time stamp (MJD) of first sample
-            double tstart = NAN;
-            // time interval between samples (s)
-            double tsamp = NAN;
-            // number of bits per time sample
-            int nbits = -1;
-            // number of time samples in the data file (rarely used any more)
-            int nsamples = -1;
-            // centre frequency (MHz) of first blimpy channel
-            double fch1 = NAN;
-            // blimpy channel bandwidth (MHz)
-            double foff = NAN;
-            // number of blimpy channels
-            int nchans = -1;
-            // number of seperate IF channels
-            int nifs = -1;
-            // reference dispersion measure (pc/cm**3)
-            double refdm = NAN;
-            // folding period (s)
-            double period = NAN;
-            //total number of beams (?)
-            int nbeams = -1;
-            // number of the beam in this file (?)
-            int ibeam = -1;
-        };
+        /** the header type (shared by all formats) */
+        typedef FileHeader Header;
 
         /** the data file header */
         Header header;
@@ -206,11 +301,11 @@ namespace watplot {
             return data_rect;
         }
 
-        /** list of frequencies (y-axis on view) */
-        std::vector<double> freqs;
+        /** frequency axis (y-axis on view) */
+        Axis freqs;
 
-        /** list of timestamps (x-axis on view) */
-        std::vector<double> timestamps;
+        /** time axis (x-axis on view) */
+        Axis timestamps;
 
         // size of file in bytes
         int64_t file_size_bytes;
@@ -219,16 +314,196 @@ namespace watplot {
         int64_t data_size_bytes;
 
         /* number of time integrations in the data file (overrides header nsamples) */
-        int64_t nints;
+        int64_t nints = -1;
+
+        /* number of channels shown: header nchans, times the number of IFs if they are shown side by side */
+        int64_t nchans_shown = -1;
+
+        /* IFs shown (see select_ifs) */
+        IFSelection ifs;
 
         /* path to data file */
         std::string file_path;
 
+        /* downsampling factor between levels of the overview pyramid; 0 to disable the pyramid */
+        int pyramid_factor = 2;
+
+        /* number of binned time columns read at once when building a view */
+        static const int64_t VIEW_STRIP = 256;
+
+        /* if true (and tsamp > 0), views may extend past the end of the data, so that samples appended to
+         * the file later can be added with extend_view */
+        bool tail_mode = false;
+
     protected:
+        /** Identify a data file by name, size and modification time (see data_id) */
+        static std::string _file_id(const std::string & path) {
+            struct stat st;
+            if (stat(path.c_str(), &st)) return path;
+            std::ostringstream ss;
+            ss << path.substr(path.find_last_of("/\\") + 1) << ":" << static_cast<int64_t>(st.st_size) << ":" <<
+                static_cast<int64_t>(st.st_mtime);
+            return ss.str();
+        }
+
+        /** Number of IFs in the data (1 if not given in the header) */
+        inline int64_t _nifs() const {
+            return max(header.nifs, 1);
+        }
+
+        /** Split shown channels [f_lo, f_hi) into runs of channels of one IF, indexed into a spectrum of all IFs
+         *  (IF k's channels start at k * nchans): one run per IF if the IFs are added up */
+        std::vector<util::ChannelRun> _channel_runs(int64_t f_lo, int64_t f_hi) const {
+            std::vector<util::ChannelRun> runs;
+            int64_t nchans = header.nchans, pos = 0;
+            for (int64_t k = 0; k < 32; ++k) {
+                if (!(ifs.mask >> k & 1)) continue;
+                if (!ifs.side_by_side) {
+                    runs.push_back(util::ChannelRun{ f_lo, f_hi, k * nchans + f_lo });
+                    continue;
+                }
+                // the pos-th IF shown is at shown channels [pos * nchans, (pos + 1) * nchans)
+                int64_t lo = max(f_lo, pos * nchans), hi = min(f_hi, (pos + 1) * nchans);
+                if (lo < hi) runs.push_back(util::ChannelRun{ lo, hi, k * nchans + lo - pos * nchans });
+                ++pos;
+            }
+            return runs;
+        }
+
+        /** Called when the IFs shown change, before the axes are set up again (implementations with
+         *  member files override this to pass on the selection) */
+        void _select_ifs() { }
+
+        /** Time axis of the data, from the header and nints (implementations whose samples are not evenly spaced,
+         *  e.g. scans stitched with gaps between them, override this) */
+        Axis _time_axis() const {
+            return Axis(header.tstart, header.tsamp, nints);
+        }
+
+        /** Set up the axes and the rectangle containing all data, from the header and nints */
+        void _init_axes() {
+            if (~header.nchans) {
+                // (implementations which know the number of time integrations, e.g. HDF5, set it in _load)
+                if (nints < 0) nints = data_size_bytes * 8 / (int64_t(header.nbits) * header.nchans * _nifs());
+                nchans_shown = header.nchans * (ifs.side_by_side ? ifs.count() : 1);
+                freqs = Axis(header.fch1, header.foff, nchans_shown);
+                timestamps = static_cast<ImplType *>(this)->_time_axis();
+                data_rect = cv::Rect2d(timestamps.lower(), freqs.lower(), timestamps.length(), freqs.length());
+            }
+        }
+
+        /** Open (building if needed) the overview pyramid on first use, and find the level to use for
+         *  the given steps; returns -1 if the data file should be read directly */
+        int _pyramid_level(int64_t t_step, int64_t f_step) const {
+            // (no need for the pyramid until the first zoomed-out view)
+            if (!pyramid_checked && pyramid_factor >= 2 && (t_step > 1 || f_step > 1)) {
+                pyramid_checked = true;
+                const ImplType * impl = static_cast<const ImplType *>(this);
+                pyramid.open(file_path, data_size_bytes, nints, nchans_shown,
+                    [impl, this](Eigen::MatrixXd & out, int64_t t_lo, int64_t t_hi, int64_t t_step,
+                                 int64_t f_lo, int64_t f_hi, int64_t f_step) {
+                        impl->_view(data_rect, out, t_lo, t_hi, t_step, f_lo, f_hi, f_step);
+                    }, pyramid_factor, ifs.suffix());
+            }
+            return pyramid.is_open() ? pyramid.find_level(t_step, f_step) : -1;
+        }
+
+        /** Add columns [i_lo, i_hi) of binned data (0 = first column after the padding) to a table
+         *  begun by view(), from strips of VIEW_STRIP columns, so that the binned data never has to be held
+         *  in full. Marks the table before a column holding only part of its samples */
+        void _push_bins(ViewTable & out, int64_t i_lo, int64_t i_hi, TileCache * cache) const {
+            ViewTable::Source & src = out.source;
+            int64_t t_lo = src.t_lo, t_step = src.t_step, f_lo = src.f_lo, f_hi = src.f_hi, f_step = src.f_step;
+            int64_t out_hi = out.rows() - 2, out_wid = out.cols() - 2;
+            double area = double(f_step * t_step);
+
+            Eigen::MatrixXd strip, cols;
+            for (int64_t s_i_lo = i_lo; s_i_lo < i_hi; s_i_lo += VIEW_STRIP) {
+                int64_t s_i_hi = min(s_i_lo + VIEW_STRIP, i_hi);
+                // bins of this strip in file order (reversed if time axis is reversed)
+                int64_t b_lo = header.tsamp < 0 ? out_wid - s_i_hi : s_i_lo;
+                int64_t s_lo = t_lo + b_lo * t_step, s_hi = s_lo + (s_i_hi - s_i_lo) * t_step;
+                strip.resize(out_hi + 2, s_i_hi - s_i_lo + 2);
+
+                // call viewer implementation (through the pyramid/tile cache, if possible)
+                if (cache) {
+                    cache->assemble(strip, s_lo, s_hi, t_step, f_lo, f_hi, f_step,
+                        [this](Eigen::MatrixXd & tile, int64_t t_lo, int64_t t_hi, int64_t t_step,
+                               int64_t f_lo, int64_t f_hi, int64_t f_step) {
+                            bin(tile, t_lo, t_hi, t_step, f_lo, f_hi, f_step);
+                        });
+                    // stopped early (see TileCache::set_abort): the table is incomplete and will be discarded
+                    if (cache->aborted()) return;
+                }
+                else {
+                    bin(strip, s_lo, s_hi, t_step, f_lo, f_hi, f_step);
+                }
+
+                const double * bins = strip.data() + (out_hi + 2);
+                if (header.foff < 0 || header.tsamp < 0) {
+                    // reverse rows/columns if frequency/time axis is reversed
+                    cols.resize(out_hi + 2, s_i_hi - s_i_lo);
+                    for (int64_t i = s_i_lo; i < s_i_hi; ++i) {
+                        int64_t b = (header.tsamp < 0 ? out_wid - 1 - i : i) - b_lo;
+                        const double * src_col = strip.data() + (b + 1) * (out_hi + 2);
+                        double * dst = cols.data() + (i - s_i_lo) * (out_hi + 2);
+                        if (header.foff < 0) std::reverse_copy(src_col, src_col + out_hi + 2, dst);
+                        else std::copy(src_col, src_col + out_hi + 2, dst);
+                    }
+                    bins = cols.data();
+                }
+
+                if (header.tsamp > 0 && s_hi > nints) {
+                    // the last column is incomplete
+                    int64_t n_full = s_i_hi - s_i_lo - 1;
+                    if (n_full) out.push_columns(bins, n_full, area);
+                    out.mark();
+                    out.push_columns(bins + n_full * (out_hi + 2), 1, area);
+                }
+                else {
+                    out.push_columns(bins, s_i_hi - s_i_lo, area);
+                }
+            }
+            src.t_end = header.tsamp > 0 ? min(nints, t_lo + i_hi * t_step) : t_lo + out_wid * t_step;
+        }
+
+        /** Extend the time axis to new_nints samples, after data has been appended to the file
+         *  (the implementation's refresh() must hold data_mtx) */
+        void _append_samples(int64_t new_nints) {
+            nints = new_nints;
+            timestamps.resize(nints);
+            data_rect.x = timestamps.lower();
+            data_rect.width = timestamps.length();
+
+            // the overview pyramid no longer matches the data
+            pyramid.close();
+            pyramid_checked = true;
+        }
+
+        /** smallest power of two >= x */
+        static int64_t _next_pow2(int64_t x) {
+            int64_t p = 1;
+            while (p < x) p <<= 1;
+            return p;
+        }
+
+        /* overview pyramid (opened lazily by view) */
+        mutable Pyramid pyramid;
+
+        /* true once opening the pyramid has been attempted */
+        mutable bool pyramid_checked = false;
+
+        /* held while building a view (on the renderer's loader thread), and while the data is being
+         * extended by the implementation's refresh() */
+        mutable std::mutex data_mtx;
 
         /** basic constructor, checks if a file exists and if so loads from it */
         BLFile(const std::string & path) { load(path); }
 
+        /** constructor for implementations not backed by a single data file, which set up the header,
+         *  sizes and nints themselves and then call _init_axes */
+        BLFile() { }
+
         /* rectangle containing all data */
         cv::Rect2d data_rect;
     };
@@ -249,9 +524,12 @@ namespace watplot {
                 file.timestamps.front() << ", " << file.timestamps.back() << "]\n";
         }
         if (!file.freqs.empty()) {
-            o << "Frequency axis:\t\t" << file.header.nchans << " channels\n Range:\t\t\t[" <<
+            o << "Frequency axis:\t\t" << file.freqs.size() << " channels\n Range:\t\t\t[" <<
                 file.freqs.front() << ", " << file.freqs.back() << "]\n";
         }
+        if (file.header.nifs > 1) {
+            o << "IFs:\t\t\t" << file.header.nifs << " (showing " << file.ifs.name() << ")\n";
+        }
         o << "Bits per sample:\t" << file.header.nbits << "\n\nStatistics\n";
         o << "File size:\t\t" << file.file_size_bytes << " bytes (data: " << file.data_size_bytes << ")\n";
         o << "---------------------------------\n";
@@ -1,6 +1,8 @@
 #pragma once
 #include "config.hpp"
 #include "blfile.hpp"
+#include "fileinfo.hpp"
 #include "filterbank.hpp"
 #include "hdf5.hpp"
+#include "stitched.hpp"
 #include "waterfall.hpp"
@@ -0,0 +1,67 @@
+#pragma once
+#include<string>
+#include<vector>
+#include<iostream>
+#include "blfile.hpp"
+
+namespace watplot {
+    /** Header and layout of a data file, read without mapping or loading the data
+     *  (and without building the axes, which are computed from the header) */
+    struct FileInfo {
+        std::string path;
+
+        /** file format name (empty if the extension is not recognized) */
+        std::string format;
+
+        /** why the file could not be read (empty if the header was read) */
+        std::string error;
+
+        FileHeader header;
+
+        int64_t file_size_bytes = -1, data_size_bytes = -1;
+
+        /* number of time integrations (-1 if unknown) */
+        int64_t nints = -1;
+
+        /** true if the header was read */
+        inline bool ok() const {
+            return error.empty();
+        }
+
+        /** frequency, time axes, as on the plot of the file */
+        inline Axis freq_axis() const {
+            return Axis(header.fch1, header.foff, max(header.nchans, 0));
+        }
+        inline Axis time_axis() const {
+            return Axis(header.tstart, header.tsamp, max(nints, int64_t(0)));
+        }
+
+        /** centre frequency of the lowest, highest channel (MHz) */
+        double f_min() const;
+        double f_max() const;
+
+        /** first, last timestamp on the time axis */
+        double t_min() const;
+        double t_max() const;
+
+        /** name of the telescope (the id if it is not known) */
+        std::string telescope_name() const;
+    };
+
+    /** Read the header of one data file (.fil, .h5, .hdf5); errors are reported in the result */
+    FileInfo stat_file(const std::string & path);
+
+    /** Read the headers of many data files in parallel, in the given order.
+     *  Reading headers mostly waits for the file system, so more threads than cores may be used
+     *  (HDF5 headers are read one at a time, since the library is not thread-safe) */
+    std::vector<FileInfo> stat_files(const std::vector<std::string> & paths);
+
+    /** Write a table of file headers as CSV, with a header row */
+    void write_csv(std::ostream & o, const std::vector<FileInfo> & infos);
+
+    /** Write a table of file headers as a JSON array of objects, one per line */
+    void write_json(std::ostream & o, const std::vector<FileInfo> & infos);
+
+    /** Print a file's header in the same layout as a loaded data file */
+    std::ostream & operator<< (std::ostream & o, const FileInfo & info);
+}
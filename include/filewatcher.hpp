@@ -0,0 +1,48 @@
+#pragma once
+#include<string>
+#include<chrono>
+
+namespace watplot {
+    /** Watches a file for modification (e.g. a data file still being written), without blocking.
+     *  Uses inotify on Linux, and otherwise (or if inotify is unavailable) polls the file's size and
+     *  modification time */
+    class FileWatcher {
+    public:
+        /** Watch the file at path
+          * @param min_interval minimum time between changes reported by changed(), in seconds
+          *                     (also the polling interval, when polling) */
+        explicit FileWatcher(const std::string & path, double min_interval = 0.1);
+        ~FileWatcher();
+
+        FileWatcher(const FileWatcher &) = delete;
+        FileWatcher & operator= (const FileWatcher &) = delete;
+
+        /** True if the file may have changed since the last time this returned true;
+          * returns false if less than min_interval has passed since then */
+        bool changed();
+
+        /** True if inotify is used (otherwise, the file is polled) */
+        inline bool uses_inotify() const {
+            return notify_fd >= 0;
+        }
+
+    private:
+        /** Read pending inotify events, or poll the file; true if any change was seen */
+        bool _check();
+
+        std::string path;
+        double min_interval;
+
+        /** A change was seen but not reported yet */
+        bool pending = false;
+
+        /** Time of the last change reported (or of the last poll) */
+        std::chrono::steady_clock::time_point last_report, last_poll;
+
+        /** inotify instance and watch (-1 if not used) */
+        int notify_fd = -1, watch_fd = -1;
+
+        /** Size and modification time at the last poll */
+        int64_t last_size = -1, last_mtime = -1;
+    };
+}
@@ -1,6 +1,8 @@
 #pragma once
 #include<string>
 #include "blfile.hpp"
+#include "fileinfo.hpp"
+#include "mmapfile.hpp"
 namespace watplot {
     /* Implementation of filterbank file loader */
     class Filterbank : public BLFile<Filterbank> {
@@ -9,16 +11,42 @@ namespace watplot {
         typedef std::shared_ptr<Filterbank> Ptr;
 
         /* Load filterbank file from the given path */
-        explicit Filterbank(const std::string & path) : BLFile<Filterbank>(path) { }
+        explicit Filterbank(const std::string & path) : BLFile<Filterbank>(path) { _map_data(); }
+
+        /** Pick up whole spectra appended to the file (e.g. by a recorder still writing it) since it was loaded
+          * or last refreshed: remaps the data and extends the time axis. Views built earlier can then be
+          * extended with extend_view
+          * @return number of time samples appended, or -1 if a view is being loaded (try again later) */
+        int64_t refresh();
+
+        /** Read only the header of the file at path (see stat_files); info.file_size_bytes must be set
+          * @return false if it is not a valid filterbank file (info.error is set) */
+        static bool read_info(const std::string & path, FileInfo & info);
+
         int64_t header_end;
     protected:
+        /* read-only mapping of the data section (everything after header_end) */
+        MappedFile data_map;
+
         /* load implementation */
         void _load(const std::string & path);
 
+        /* map the data section into memory (members are not yet constructed during _load) */
+        void _map_data();
+
         /* view implementation */
         void _view(const cv::Rect2d & rect, Eigen::MatrixXd & out, int64_t t_lo, int64_t t_hi, int64_t t_step,
                                                                    int64_t f_lo, int64_t f_hi, int64_t f_step) const;
 
         static const std::string FILE_FORMAT_NAME;
+
+        /* blocks of time bins per thread when binning a view (for load balancing) */
+        static const int64_t VIEW_BLOCKS_PER_THREAD;
+
+        /* approximate bytes of the data file binned at once when building a view */
+        static const int64_t VIEW_CHUNK_BYTES;
+
+        /* number of chunks read ahead of the chunk being binned */
+        static const int64_t PREFETCH_CHUNKS;
     };
 }
@@ -2,6 +2,7 @@
 #include<string>
 #include<H5Cpp.h>
 #include "blfile.hpp"
+#include "fileinfo.hpp"
 namespace watplot {
     /* Implementation of HDF5 file loader */
     class HDF5 : public BLFile<HDF5> {
@@ -10,17 +11,49 @@ namespace watplot {
         typedef std::shared_ptr<HDF5> Ptr;
 
         /* Load HDF5 file from the given path */
-        explicit HDF5(const std::string & path) : BLFile<HDF5>(path) { }
+        explicit HDF5(const std::string & path) : BLFile<HDF5>(path) {
+            std::lock_guard<std::mutex> lock(library_mtx);
+            _open_data();
+        }
+
+        /** Read only the header and dimensions of the file at path (see stat_files)
+          * @return false if it is not a valid data file (info.error is set) */
+        static bool read_info(const std::string & path, FileInfo & info);
 
     protected:
         /* load implementation */
         void _load(const std::string & path);
 
+        /* open the persistent file/dataset handles (with a chunk cache sized for the dataset's chunk layout),
+         * or reopen them if the file's modification time has changed; library_mtx must be held
+         * (members are not yet constructed during _load, so this is called from the constructor and _view) */
+        void _open_data() const;
+
         /* view implementation */
         void _view(const cv::Rect2d & rect, Eigen::MatrixXd & out, int64_t t_lo, int64_t t_hi, int64_t t_step,
                                                                    int64_t f_lo, int64_t f_hi, int64_t f_step) const;
 
         static const std::string FILE_FORMAT_NAME;
         static const std::string DATASET_SUBSET_NAME;
+
+        /* approximate bytes of samples read at once when building a view (rounded to whole rows of chunks) */
+        static const int64_t VIEW_BLOCK_BYTES;
+
+        /* maximum size of the HDF5 raw data chunk cache */
+        static const int64_t MAX_CHUNK_CACHE_BYTES;
+
+        /* persistent handles to the data file and dataset, reused across views */
+        mutable H5::H5File data_file;
+        mutable H5::DataSet data_set;
+
+        /* modification time of the data file when the handles were opened */
+        mutable int64_t data_mtime = -1;
+
+        /* chunk size along time, frequency */
+        mutable int64_t chunk_t = 1, chunk_f = 1;
+
+        /* guards all calls into the HDF5 library, which is not thread-safe
+         * (views are built on the renderer's background thread) */
+        static std::mutex library_mtx;
     };
 }
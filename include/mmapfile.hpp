@@ -0,0 +1,59 @@
+#pragma once
+#include<string>
+
+namespace watplot {
+    /** Read-only memory mapping of (part of) a file.
+     *  Used to read data files in place, without copying through an intermediate buffer */
+    class MappedFile {
+    public:
+        /** Access pattern hints, passed to the OS (madvise) */
+        enum Advice {
+            NORMAL, SEQUENTIAL, RANDOM, WILLNEED
+        };
+
+        MappedFile() { }
+        ~MappedFile();
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile & operator= (const MappedFile &) = delete;
+
+        /** Map the bytes [offset, offset + size) of the file at path (size -1: until end of file).
+         *  An empty range is a valid, empty mapping (data() is null, size() is 0)
+         *  @return true on success */
+        bool open(const std::string & path, int64_t offset = 0, int64_t size = -1);
+
+        /** Unmap the file, if mapped */
+        void close();
+
+        /** Give the OS a hint about how the bytes [offset, offset + len) will be accessed (len -1: until end) */
+        void advise(Advice advice, int64_t offset = 0, int64_t len = -1) const;
+
+        /** Pointer to the first mapped byte (the byte at 'offset' in the file) */
+        inline const char * data() const {
+            return _data;
+        }
+
+        /** Number of bytes mapped */
+        inline int64_t size() const {
+            return _size;
+        }
+
+        /** True if a file is currently mapped (false for an empty mapping) */
+        inline bool is_open() const {
+            return _base != nullptr;
+        }
+
+    private:
+        // start of the actual mapping (aligned to page boundary, <= _data)
+        char * _base = nullptr;
+        // size of the actual mapping in bytes
+        int64_t _base_size = 0;
+        // pointer to the requested offset
+        const char * _data = nullptr;
+        // requested size
+        int64_t _size = 0;
+#ifdef _WIN32
+        HANDLE _file = INVALID_HANDLE_VALUE, _mapping = NULL;
+#endif
+    };
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include<string>
+#include<vector>
+#include<functional>
+#include "mmapfile.hpp"
+
+namespace watplot {
+    /** Multi-resolution pyramid of binned sums over a data file, persisted as a sidecar file
+     *  (data file path + SIDECAR_EXT, see open) and keyed by the data file's path, size and modification time.
+     *  Level i holds the sums of fac_t x fac_f blocks of samples, in file order
+     *  (column-major, one column of n_f frequency bins per time bin), with each level
+     *  'factor' times coarser than the last along every axis that is still long enough.
+     *  Used by BLFile::view to answer zoomed-out views in time proportional to the output size. */
+    class Pyramid {
+    public:
+        /** Computes binned sums from the data file, with the same arguments/output as BLFile's _view:
+         *  (out, t_lo, t_hi, t_step, f_lo, f_hi, f_step) */
+        typedef std::function<void(Eigen::MatrixXd &, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t)> BinFunc;
+
+        /** A single level of the pyramid */
+        struct Level {
+            // number of samples per bin along time, frequency
+            int64_t fac_t, fac_f;
+            // number of bins along time, frequency
+            int64_t n_t, n_f;
+            // byte offset of the level in the sidecar
+            int64_t offset;
+            // pointer to the sums (into the sidecar mapping, or into mem if the sidecar could not be written)
+            const double * data;
+            // in-memory storage, used only if the sidecar could not be written
+            Eigen::MatrixXd mem;
+        };
+
+        /** Open the pyramid for a data file, building it (one pass over the data using bin) if the sidecar
+         *  is missing or stale. Does nothing and returns false if the data is smaller than MIN_DATA_BYTES.
+         *  @param factor downsampling factor between consecutive levels
+         *  @param variant appended to the sidecar's name, to keep pyramids of different selections of the data
+         *                 (e.g. of IFs, see IFSelection) apart
+         *  @return true if the pyramid is usable */
+        bool open(const std::string & path, int64_t data_size_bytes, int64_t nints, int64_t nchans,
+                  const BinFunc & bin, int factor = 2, const std::string & variant = "");
+
+        /** Find the coarsest level that can produce bins of t_step x f_step samples
+         *  without losing more than MAX_ROUNDING of the requested resolution along either axis
+         *  @return level index, or -1 if no level is suitable */
+        int find_level(int64_t t_step, int64_t f_step) const;
+
+        /** Find the coarsest level whose blocks evenly tile bins of t_step x f_step samples starting at (t_lo, f_lo)
+         *  @return level index, or -1 if no level is suitable */
+        int find_aligned_level(int64_t t_lo, int64_t t_step, int64_t f_lo, int64_t f_step) const;
+
+        /** Compute binned sums from a level, with the same arguments/output as BLFile's _view.
+         *  t_lo, t_step must be multiples of the level's fac_t; f_lo, f_step multiples of fac_f */
+        void view(int level, Eigen::MatrixXd & out, int64_t t_lo, int64_t t_hi, int64_t t_step,
+                  int64_t f_lo, int64_t f_hi, int64_t f_step) const;
+
+        /** Get a level */
+        inline const Level & level(int i) const {
+            return levels[i];
+        }
+
+        /** Close the pyramid (e.g. when it no longer matches the data file) */
+        void close();
+
+        /** True if the pyramid has been opened successfully */
+        inline bool is_open() const {
+            return !levels.empty();
+        }
+
+        /** Only data files at least this large get a pyramid */
+        static const int64_t MIN_DATA_BYTES;
+
+        /** Maximum size of the finest level */
+        static const int64_t MAX_BASE_BYTES;
+
+        /** Axes are not downsampled further once they have at most this many bins */
+        static const int64_t MIN_BINS;
+
+        /** Maximum fraction of resolution that may be lost by rounding a step up to a level's block size */
+        static const double MAX_ROUNDING;
+
+        /** Extension appended to the data file path to get the sidecar path */
+        static const std::string SIDECAR_EXT;
+
+    private:
+        /** Compute the block sizes and dimensions of all levels */
+        void _plan(int64_t nints, int64_t nchans, int factor);
+
+        /** Try to load the sidecar; returns false if it is missing or stale */
+        bool _load(const std::string & sidecar, const std::string & path, int64_t file_size, int64_t mtime,
+                   int64_t nints, int64_t nchans, int factor);
+
+        /** Build all levels and write the sidecar */
+        void _build(const std::string & sidecar, const std::string & path, int64_t file_size, int64_t mtime,
+                    int64_t nints, int64_t nchans, int factor, const BinFunc & bin);
+
+        /** Levels, finest first */
+        std::vector<Level> levels;
+
+        /** Mapping of the sidecar file */
+        MappedFile sidecar_map;
+    };
+}
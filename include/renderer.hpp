@@ -1,5 +1,7 @@
 #pragma once
 #include "util.hpp"
+#include "tilecache.hpp"
+#include "viewtable.hpp"
 
 namespace watplot {
     /** Abstract base class for renderers */
@@ -7,16 +9,48 @@ namespace watplot {
     public:
         typedef std::shared_ptr<Renderer> Ptr;
 
+        /** Extents in the view of plot pixels along one view axis (struct of arrays, for the row kernel) */
+        struct PixelSpans {
+            // bounds, clamped to the view (both 0 if outside of the view)
+            std::vector<double> lo, hi;
+            // inner bounds (ceil(lo), floor(hi)) and outer bounds (floor(lo), ceil(hi))
+            std::vector<int> in_lo, in_hi, out_lo, out_hi;
+
+            void resize(size_t n);
+
+            /** Set span i to [lo, hi), clamped to [0, max_val] */
+            void set(size_t i, double lo, double hi, double max_val);
+        };
+
         // terminology: render=what is displayed to user; view=chunk of data cached in memory, larger than render
         /** Render to an image of size plot_size (must be implemented in child class)
           * @param recompute_view 2=force recompute; 0=force use old view; 1=smart
-          * @param rendered image. CV_8UC3
+          * @param rendered image. CV_8UC3 (its buffer is reused by the next render; clone it to keep it)
           */
         cv::Mat render(int recompute_view = 1);
 
-        /** Get the last render */
+        /** Get the last render (see render) */
         cv::Mat get_last_render() const;
 
+        /** Render for interaction (e.g. on every mouse move while dragging): if rendering at full resolution
+          * is estimated to take longer than frame_budget, renders a preview at 1/2, 1/4 or 1/8 resolution
+          * (from the same view, with larger boxes) and schedules the full-resolution render for refine().
+          * Same return value as render() */
+        cv::Mat render_interactive();
+
+        /** Continue the scheduled full-resolution render, if any, once interaction has paused: computes
+          * about frame_budget's worth of pixels per call, and renders when they are all done. Any render
+          * before then cancels it; should be called regularly from the event loop
+          * @return true if re-rendered */
+        bool refine();
+
+        /** Re-render (see render_interactive) if a view loaded in the background is ready to be swapped in;
+          * should be called regularly from the event loop
+          * @return true if re-rendered */
+        bool poll();
+
+        virtual ~Renderer();
+
         /** Helper for projecting plot point to (time, frequency) space */
         cv::Point2d plot_to_time_freq(cv::Point2d point) const;
 
@@ -56,6 +90,20 @@ namespace watplot {
         /** Whether log scale is used for coloring output */
         bool log_scale = false;
 
+        /** Percentiles of the plot's pixels shown at the lowest, highest color by auto-levels
+          * (0, 100: the minimum and maximum, which a few very bright pixels, e.g. RFI, would set) */
+        double levels_low = 1.0, levels_high = 99.5;
+
+        /** Whether auto-levels track the plot, i.e. the color scale is recomputed at every render
+          * (e.g. while panning); otherwise, it is only computed at the first render and after reset_levels() */
+        bool track_levels = false;
+
+        /** Recompute the color scale (auto-levels) at the next render */
+        void reset_levels();
+
+        /** Time budget of interactive renders, in seconds (see render_interactive); 0: always full resolution */
+        double frame_budget = 0.04;
+
     protected:
 
         /**
@@ -78,6 +126,27 @@ namespace watplot {
         /** render implmentation */
         virtual cv::Mat _render(int recompute_view = 1) = 0;
 
+        /** Load the view covering rect (must be implemented in child class); called on the loader thread.
+          * Same arguments/return value as BLFile::view */
+        virtual cv::Rect2d _load_view(const cv::Rect2d & rect, ViewTable & out, int max_wid, int max_hi) = 0;
+
+        /** Update the view according to recompute_view (see render()); in smart mode, the view is reloaded
+          * in the background if it does not cover the render or is too coarse, and the stale view is kept
+          * until the new one is ready */
+        void update_view(int recompute_view);
+
+        /** Stop the loader thread, if running (child classes must call this in their destructor,
+          * since the loader calls _load_view) */
+        void stop_loader();
+
+        /** Called after a view loaded in the background has been swapped in (e.g. to add data appended
+          * to the file while it was loading) */
+        virtual void _view_swapped() { }
+
+        /** Update data_rect after data has been appended to the file, and re-render. If the render reached
+          * the end of the data, it is scrolled along with it */
+        void data_appended(const cv::Rect2d & new_data_rect);
+
         /** update ratios*/
         void update_dxy();
 
@@ -87,12 +156,57 @@ namespace watplot {
         /** Compute the power at a particular plot pixel */
         float compute_pixel(const cv::Point2i & point) const;
 
+        /** Compute the power at pixels [x_lo, x_hi) of plot row y into out[x_lo...x_hi) (by default, the whole row;
+          * same results as compute_pixel); prepare_columns() must have been called after the last update
+          * of the view/render */
+        void compute_row(int y, float * out, int x_lo = 0, int x_hi = -1) const;
+
+        /** Compute the mean power over the whole plotted time range at each plot column (frequency) into
+          * out[0...plot_size.width), from the view's sums in O(plot_size.width); columns must be prepared
+          * as for compute_row */
+        void compute_spectrum(float * out) const;
+
+        /** Compute the mean power over the whole plotted band at each plot row (time) into
+          * out[0...plot_size.height), from the view's sums in O(plot_size.height) */
+        void compute_time_series(float * out) const;
+
+        /** Compute the power at all plot pixels into raw (a new CV_32F buffer of plot_size, which must not be
+          * modified), adding them to hist if given. If the plot has only been panned by whole pixels since
+          * the last call, with the same view and resolution, the last pixels are shifted into place and only
+          * the exposed strips are computed. In a preview, each box of preview x preview pixels is computed
+          * as one pixel */
+        void compute_pixels(cv::Mat & raw, util::LogHistogram * hist = nullptr);
+
+        /** Forget the pixels of the last compute_pixels call (e.g. after the view's data has changed) */
+        void invalidate_pixels();
+
+        /** Precompute the view extents of all plot columns, used by compute_row */
+        void prepare_columns();
+
+        /** True if the next render must compute auto-levels (the histogram of its pixels) */
+        bool need_levels() const;
+
+        /** Auto-levels: set the color scales (linear and log) from the histogram of the plot's pixels, so that
+          * the levels_low to levels_high percentiles span the color map */
+        void set_levels(const util::LogHistogram & hist);
+
+        /** Storage type of views */
+        const ViewTable::Storage view_storage = ViewTable::FLOAT;
+
         /** The current view */
-        Eigen::MatrixXd view;
+        ViewTable view;
+
+        /** The boundaries of all data, and the size of a single sample (time, frequency);
+          * must be set by child class */
+        cv::Rect2d data_rect;
+        cv::Point2d sample_size;
 
         /** The window name */
         const std::string wind_name;
 
+        /** Cache of binned data tiles, from which views are assembled */
+        TileCache tiles;
+
         /** The boundaries of the current view */
         cv::Rect2d view_rect;
 
@@ -104,5 +218,103 @@ namespace watplot {
 
         /** cached ratios */
         double dx, dy, px, py;
+
+        /** View (frequency) extents of plot columns */
+        PixelSpans col_spans;
+
+        /** Maximum number of render pixels a single view bin may span before the view is reloaded */
+        static const double MAX_BIN_PIXELS;
+
+        /** Maximum factor by which the view is larger than the render, along each axis */
+        static const double MAX_VIEW_EXPANSION;
+
+        /** Number of consecutive plot rows computed by a task (neighbouring view columns) */
+        static const int ROW_BLOCK;
+
+        /** Tolerance (in pixels) of a pan to be a whole number of pixels */
+        static const double PAN_EPS;
+
+        /** Lowest preview resolution (1 / MAX_PREVIEW) */
+        static const int MAX_PREVIEW;
+
+        /** Resolution divisor of the render in progress (1: full resolution; see render_interactive) */
+        int preview = 1;
+
+    private:
+        /** True if a view of rect with bins of size bin_x x bin_y covers the render at sufficient resolution */
+        bool _adequate(const cv::Rect2d & rect, double bin_x, double bin_y) const;
+
+        /** True if the view no longer covers the render or is too coarse for it */
+        bool _view_stale() const;
+
+        /** Queue a load of a view around the render, shifted in the direction of motion;
+          * if wait, blocks until it is loaded and swaps it in */
+        void _request_view(bool wait);
+
+        /** Swap in the view loaded in the background, if any; returns true if swapped */
+        bool _swap_view();
+
+        /** If the last pixels can be reused (see compute_pixels), set the whole-pixel pan since then
+          * (new row y, column x is old row y - sy, column x + sx) and return true */
+        bool _pan_shift(int & sy, int & sx) const;
+
+        /** Compute the power of boxes [x_lo, x_hi) of view extents: the time extent of each is span 0 of row,
+          * the frequency extent of box x is span x of cols */
+        void _compute_spans(const PixelSpans & row, const PixelSpans & cols, int x_lo, int x_hi, float * out) const;
+
+        /** Record the time taken to compute n pixels (for estimating render times) */
+        void _time_pixels(double seconds, int64_t n);
+
+        /** Loader thread main loop */
+        void _loader_loop();
+
+        /** Loader thread, started on the first request */
+        std::thread loader;
+        std::mutex loader_mutex;
+        std::condition_variable loader_cv;
+
+        /** Loader state (guarded by loader_mutex) */
+        bool loader_stop = false, request_pending = false, loading = false, next_ready = false;
+
+        /** Set when a request is queued (or the loader is stopping) to cut short the speculative load */
+        std::atomic<bool> abort_speculative{ false };
+
+        /** Requested view rectangle, size and direction of motion (guarded by loader_mutex) */
+        cv::Rect2d request_rect;
+        int request_wid, request_hi;
+        cv::Point2d request_motion;
+
+        /** View loaded in the background, waiting to be swapped in, and the rectangle requested for it
+          * (guarded by loader_mutex) */
+        ViewTable next_view;
+        cv::Rect2d next_view_rect, next_request_rect;
+
+        /** Rectangle requested for the current view */
+        cv::Rect2d view_request_rect;
+
+        /** Direction of recent panning (in units of render width/height), used for prefetching */
+        cv::Point2d motion;
+
+        /** Render rectangle at the previous render */
+        cv::Rect2d last_render_rect;
+
+        /** Pixels of the last compute_pixels call (empty if they can not be reused), and the projection
+          * (dx, dy, px, py) they were computed with */
+        cv::Mat last_raw;
+        double last_raw_dx, last_raw_dy, last_raw_px, last_raw_py;
+
+        /** Scheduled full-resolution render (see refine): whether scheduled, the pixels computed so far
+          * (rows [0, refine_rows)) and when the last interactive render finished */
+        bool refine_pending = false;
+        cv::Mat refine_raw;
+        int refine_rows = 0;
+        std::chrono::high_resolution_clock::time_point last_interaction;
+
+        /** Estimated time to compute one pixel, and time taken by the rest of a render (e.g. coloring),
+          * in seconds (0 until measured) */
+        double pixel_time = 0.0, frame_overhead = 0.0;
+
+        /** Time taken by compute_pixels in the render in progress */
+        double compute_time = 0.0;
     };
 }
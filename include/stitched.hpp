@@ -0,0 +1,67 @@
+#pragma once
+#include<string>
+#include<vector>
+#include<memory>
+#include "blfile.hpp"
+namespace watplot {
+    /* Implementation of a virtual data file made of several data files (.fil or .h5, e.g. the consecutive scans
+     * of a session, or the sub-bands recorded by different compute nodes), concatenated in time or in frequency */
+    class Stitched : public BLFile<Stitched> {
+    friend class BLFile<Stitched>;
+    public:
+        typedef std::shared_ptr<Stitched> Ptr;
+
+        /** Axis along which the member files are concatenated */
+        enum Along {
+            TIME, FREQUENCY
+        };
+
+        /** A data file making up part of the virtual data file */
+        struct Member {
+            std::string path;
+            Header header;
+            int64_t nints;
+            // sizes of the member file and of its data, in bytes
+            int64_t file_size_bytes, data_size_bytes;
+            // index of the member's first sample (TIME) or channel (FREQUENCY) in the virtual file, in file order
+            // (samples/channels between members are empty)
+            int64_t offset;
+            // number of samples (TIME) or channels (FREQUENCY) in the member
+            int64_t length;
+            // computes binned sums from the member, as BLFile::bin
+            Pyramid::BinFunc bin;
+            // chooses the member's IFs shown, as BLFile::select_ifs
+            std::function<void(const IFSelection &)> select_ifs;
+            // the member's file object
+            std::shared_ptr<void> file;
+        };
+
+        /** Open data files, concatenating them in time if they have the same frequency channels, otherwise
+          * in frequency, as sub-bands of a mosaic (which must have the same start time and sample time).
+          * Members are ordered by start time/first channel, and placed at their start time/first channel:
+          * samples in time gaps between scans and channels missing between sub-bands are shown as 0 */
+        explicit Stitched(const std::vector<std::string> & paths);
+
+        /** Identifies the data by the members' file names, sizes and modification times (see BLFile::data_id) */
+        std::string data_id() const;
+
+        /** Axis along which the members are concatenated */
+        Along along;
+
+        /** Member files, in file order along the concatenated axis (offsets increasing) */
+        std::vector<Member> members;
+
+    protected:
+        /* pass the IFs shown on to the members */
+        void _select_ifs();
+
+        /* time axis with one evenly spaced segment per scan, at its own start time */
+        Axis _time_axis() const;
+
+        /* view implementation */
+        void _view(const cv::Rect2d & rect, Eigen::MatrixXd & out, int64_t t_lo, int64_t t_hi, int64_t t_step,
+                                                                   int64_t f_lo, int64_t f_hi, int64_t f_step) const;
+
+        static const std::string FILE_FORMAT_NAME;
+    };
+}
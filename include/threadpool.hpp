@@ -0,0 +1,78 @@
+#pragma once
+#include<vector>
+#include<deque>
+#include<memory>
+#include<functional>
+
+namespace watplot {
+    /** Persistent pool of worker threads running parallel loops.
+     *  A loop is split into contiguous blocks of indices, which are dealt out to the workers' queues in runs
+     *  (so each worker starts on neighbouring blocks); a worker whose queue is empty steals from the back of
+     *  another worker's queue. The calling thread also runs blocks of its own loop until the loop is done
+     *  (never blocks of loops called from other threads), so loops may be nested. */
+    class ThreadPool {
+    public:
+        /** Create a pool running loops on num_threads threads in total (including the calling thread);
+          * -1: use default_size() */
+        explicit ThreadPool(int num_threads = -1);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool & operator= (const ThreadPool &) = delete;
+
+        /** Call f(lo, hi) for blocks [lo, hi) of at most 'grain' indices covering [l, r), in parallel.
+          * Returns once all blocks are done. grain <= 0: split evenly over the threads */
+        void parallel_for(int l, int r, int grain, const std::function<void(int, int)> & f);
+
+        /** Number of threads running loops (workers + calling thread) */
+        inline int size() const {
+            return static_cast<int>(workers.size()) + 1;
+        }
+
+        /** The shared pool, created on first use with default_size() threads */
+        static ThreadPool & global();
+
+        /** Default number of threads: the WATPLOT_THREADS environment variable if set and positive,
+          * otherwise the number of hardware threads */
+        static int default_size();
+
+    private:
+        /** Counter of unfinished blocks of one parallel_for call */
+        struct Batch {
+            int remaining;
+            std::mutex mtx;
+            std::condition_variable cv;
+        };
+
+        /** A block of a loop */
+        struct Task {
+            const std::function<void(int, int)> * f;
+            int lo, hi;
+            Batch * batch;
+        };
+
+        /** A worker's queue; the owner pops from the front, thieves from the back */
+        struct Queue {
+            std::mutex mtx;
+            std::deque<Task> tasks;
+        };
+
+        /** Run one block (of batch 'only', if given), from queue 'self' if possible, otherwise stolen from
+          * another queue; returns false if there is no such block in any queue */
+        bool _run_one(size_t self, const Batch * only = nullptr);
+
+        /** Worker thread main loop */
+        void _worker(size_t self);
+
+        std::vector<std::thread> workers;
+
+        /** One queue per worker, plus one for callers */
+        std::vector<std::unique_ptr<Queue> > queues;
+
+        /** Number of queued blocks, and signal for idle workers (guarded by sleep_mtx) */
+        int pending = 0;
+        bool stop = false;
+        std::mutex sleep_mtx;
+        std::condition_variable sleep_cv;
+    };
+}
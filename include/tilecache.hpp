@@ -0,0 +1,102 @@
+#pragma once
+#include<list>
+#include<unordered_map>
+#include<functional>
+#include<atomic>
+#include "tilestore.hpp"
+
+namespace watplot {
+    /** LRU cache of binned data, in fixed-size tiles of TILE_SIZE x TILE_SIZE bins (time x frequency).
+     *  Tiles are keyed by their binning level (t_step, f_step) and position, in file order indices.
+     *  Views assembled from the cache only read the tiles not already resident,
+     *  so panning only costs the newly exposed strip. Optionally backed by an on-disk TileStore,
+     *  from which tiles evicted (or binned in an earlier session) are read back before binning them again. */
+    class TileCache {
+    public:
+        /** Computes binned sums from the data file, with the same arguments/output as BLFile's _view:
+         *  (out, t_lo, t_hi, t_step, f_lo, f_hi, f_step) */
+        typedef std::function<void(Eigen::MatrixXd &, int64_t, int64_t, int64_t, int64_t, int64_t, int64_t)> BinFunc;
+
+        /** Create a cache holding at most budget_bytes of tiles */
+        explicit TileCache(int64_t budget_bytes = consts::MEMORY / 4) : budget_bytes(budget_bytes) { }
+
+        /** Fill out with the binned sums of [t_lo, t_hi) x [f_lo, f_hi), in the same layout as BLFile's _view,
+         *  reading missing tiles through bin. t_lo, t_hi must be multiples of t_step; f_lo, f_hi of f_step */
+        void assemble(Eigen::MatrixXd & out, int64_t t_lo, int64_t t_hi, int64_t t_step,
+                      int64_t f_lo, int64_t f_hi, int64_t f_step, const BinFunc & bin);
+
+        /** Drop all tiles */
+        void clear();
+
+        /** Keep tiles on disk, in directory dir, for the data identified by data_id (see TileStore::open)
+         *  @return true if the directory is usable */
+        bool open_store(const std::string & dir, const std::string & data_id);
+
+        /** Set the number of time samples in the data file. If it has changed since the last call
+         *  (e.g. data was appended), drops the tiles reaching past the end of the shorter data,
+         *  which hold empty or partial bins, and stops using the on-disk store */
+        void set_extent(int64_t n_t);
+
+        /** While *flag is set, assemble() stops at the next tile column, leaving its output incomplete
+         *  (nullptr: never stop). The tiles binned so far are kept */
+        inline void set_abort(const std::atomic<bool> * flag) {
+            abort = flag;
+        }
+
+        /** True if the last assemble() was stopped early by the abort flag */
+        inline bool aborted() const {
+            return abort && *abort;
+        }
+
+        /** Number of bytes of tiles currently held */
+        inline int64_t size_bytes() const {
+            return bytes;
+        }
+
+        /** Number of bins along each side of a tile */
+        static const int64_t TILE_SIZE;
+
+    private:
+        struct Key {
+            int64_t t_step, f_step, ti, fi;
+            bool operator==(const Key & other) const {
+                return t_step == other.t_step && f_step == other.f_step && ti == other.ti && fi == other.fi;
+            }
+        };
+
+        struct KeyHash {
+            size_t operator()(const Key & key) const {
+                size_t h = std::hash<int64_t>()(key.t_step);
+                h = h * 31 + std::hash<int64_t>()(key.f_step);
+                h = h * 31 + std::hash<int64_t>()(key.ti);
+                return h * 31 + std::hash<int64_t>()(key.fi);
+            }
+        };
+
+        struct Entry {
+            // binned sums (TILE_SIZE x TILE_SIZE, frequency x time)
+            Eigen::MatrixXd data;
+            // position in the LRU list
+            std::list<Key>::iterator lru_it;
+        };
+
+        /** Evict least recently used tiles until within budget (keeping at least 'keep' tiles) */
+        void _evict(size_t keep);
+
+        /** Tiles, most recently used at the front of lru */
+        std::unordered_map<Key, Entry, KeyHash> tiles;
+        std::list<Key> lru;
+
+        /** Current and maximum total size of tiles, in bytes */
+        int64_t bytes = 0, budget_bytes;
+
+        /** Number of time samples in the data file, as of the last set_extent (-1: not set) */
+        int64_t extent = -1;
+
+        /** On-disk store of tiles (if opened) */
+        TileStore store;
+
+        /** Flag stopping assemble() early (see set_abort) */
+        const std::atomic<bool> * abort = nullptr;
+    };
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include<string>
+
+namespace watplot {
+    /** On-disk store of tiles of binned data (see TileCache), compressed, so that regions browsed before
+     *  (in this or an earlier session, possibly by another user sharing the directory) are decoded
+     *  instead of binned again from the data file. Each tile is a file in the store's directory, named after
+     *  the data it was binned from (see BLFile::data_id), its binning level and its position.
+     *  Tiles are compressed with a built-in lossless codec: each 64-bit sample is XORed with the previous one
+     *  (along frequency), the bytes are shuffled into 8 planes (so that the mostly-zero high and low bytes
+     *  end up together), and the planes are run-length encoded. */
+    class TileStore {
+    public:
+        /** Store tiles of the data identified by data_id in directory dir (created if it does not exist)
+         *  @return true if the directory is usable */
+        bool open(const std::string & dir, const std::string & data_id);
+
+        /** Stop using the directory */
+        void close();
+
+        /** True if open() succeeded */
+        inline bool is_open() const {
+            return !prefix.empty();
+        }
+
+        /** Read a tile of n_f x n_t bins (frequency x time)
+         *  @return false if the tile is not stored (or the file is damaged) */
+        bool load(int64_t t_step, int64_t f_step, int64_t ti, int64_t fi, Eigen::MatrixXd & tile) const;
+
+        /** Write a tile (if the file cannot be written, the tile is not stored) */
+        void save(int64_t t_step, int64_t f_step, int64_t ti, int64_t fi, const Eigen::MatrixXd & tile) const;
+
+        /** Compress n samples, appending to out */
+        static void encode(const double * data, int64_t n, std::string & out);
+
+        /** Decompress exactly n samples from len bytes
+         *  @return false if the input is damaged */
+        static bool decode(const char * in, int64_t len, double * data, int64_t n);
+
+        /** Extension of tile files */
+        static const std::string TILE_EXT;
+
+    private:
+        /** Path of a tile's file */
+        std::string _tile_path(int64_t t_step, int64_t f_step, int64_t ti, int64_t fi) const;
+
+        /** Path prefix of the tiles of this data: directory + hash of data_id */
+        std::string prefix;
+    };
+}
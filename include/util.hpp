@@ -1,4 +1,5 @@
 #pragma once
+#include<cstdint>
 #include<string>
 #include<vector>
 #include<utility>
@@ -119,11 +120,13 @@ namespace watplot {
         /* find distance between closest pair in set of 2D points 'points' O(nlogn) */
         double closest_pair_dist(const std::vector<point_t> & points);
 
-        /* parallel for. divides interval [l, r) to subintervals and passes them to threads */
+        /* parallel for. divides interval [l, r) to num_threads subintervals (-1: one per thread of the shared
+         * ThreadPool) and runs them on the shared ThreadPool */
         void par_for(std::function<void(int, int)> f, int l, int r, int num_threads = -1);
 
-        /* parallel foreach. each worker thread consumes from [l, r) whenever available */
-        void par_foreach(std::function<void(int)> f, int l, int r, std::mutex * mtx = NULL, int num_threads = -1);
+        /* parallel foreach. each index in [l, r) is a separate block on the shared ThreadPool, so idle
+         * threads pick up (or steal) indices whenever available */
+        void par_foreach(std::function<void(int)> f, int l, int r);
 
         /* find GCD */
         template<class T>
@@ -149,6 +152,66 @@ namespace watplot {
         double double_to_angle(double angle);
 
 
+        /** Bin one spectrum (time sample) of raw samples of type T into an output column:
+         *  adds the sums of each f_step consecutive channels, times scale, to out[0...n_f_bins),
+         *  and the sum of the f_xtra channels after those to out[n_f_bins] */
+        template<class T>
+        void bin_spectrum(const char * in, double * out, int64_t n_f_bins, int64_t f_step, int64_t f_xtra,
+                          double scale = 1.0)
+        {
+            const T * in_t = reinterpret_cast<const T *>(in);
+            Eigen::Map<Eigen::VectorXd> out_mp(out, n_f_bins);
+            if (f_step == 1) {
+                Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, 1>> in_mp(in_t, n_f_bins);
+                out_mp += in_mp.template cast<double>() * scale;
+            }
+            else {
+                Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>> in_mp(in_t, f_step, n_f_bins);
+                out_mp += in_mp.template cast<double>().colwise().sum().transpose() * scale;
+            }
+
+            if (f_xtra) {
+                Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, 1>> in_mp_xtra(in_t + f_step * n_f_bins, f_xtra);
+                out[n_f_bins] += in_mp_xtra.template cast<double>().sum() * scale;
+            }
+        }
+
+        /** A run of consecutive shown channels [lo, hi), which are the channels starting at index src of a spectrum
+         *  (e.g. of several IFs, one after another) */
+        struct ChannelRun {
+            int64_t lo, hi, src;
+        };
+
+        /** Bin runs of channels of one spectrum of raw samples of type T into an output column:
+         *  adds each channel c of the runs, times scale, to out[(c - f_lo) / f_step].
+         *  Runs may overlap (their channels are added up) and need not start on a bin */
+        template<class T>
+        void bin_runs(const char * in, const std::vector<ChannelRun> & runs, int64_t f_lo, int64_t f_step,
+                      double * out, double scale = 1.0)
+        {
+            for (const ChannelRun & r : runs) {
+                const char * run_in = in + r.src * sizeof(T);
+                int64_t lo = r.lo, bin = (lo - f_lo) / f_step;
+                if ((lo - f_lo) % f_step) {
+                    // fill up the bin the run starts in
+                    int64_t head = min(f_lo + (bin + 1) * f_step, r.hi) - lo;
+                    bin_spectrum<T>(run_in, out + bin, 0, f_step, head, scale);
+                    run_in += head * sizeof(T);
+                    lo += head;
+                    ++bin;
+                }
+                bin_spectrum<T>(run_in, out + bin, (r.hi - lo) / f_step, f_step, (r.hi - lo) % f_step, scale);
+            }
+        }
+
+        /** Bin runs of channels of one spectrum of packed nbits-bit unsigned samples (nbits = 1, 2 or 4; stored
+         *  least significant bits first, as written by sigproc) into an output column, like bin_runs.
+         *  The samples are unpacked with per-byte lookup tables while binning (bins covering whole bytes add
+         *  up a byte's samples with one lookup), without unpacking the spectrum into a buffer. On CPUs with AVX2,
+         *  runs of whole bytes are unpacked (and wide bins summed) 16-32 bytes at a time, with pshufb nibble lookups */
+        void bin_runs_packed(const char * in, int nbits, const std::vector<ChannelRun> & runs, int64_t f_lo,
+                             int64_t f_step, double * out, double scale = 1.0);
+
         /** Applies color map
           * @param gray input gray image 8UC1
           * @param color output color image 8UC3
@@ -157,6 +220,69 @@ namespace watplot {
           **/
         void applyColorMap(const cv::Mat & gray, cv::Mat & color, bool reverse = false, int cmap_id = 13);
 
+        /** Colors of the 256 gray levels under a color map (as applied by applyColorMap), BGR */
+        struct ColorLUT {
+            uint8_t bgr[256][3];
+        };
+
+        /** The (precomputed) lookup table of color map cmap_id; see applyColorMap for ids */
+        const ColorLUT & color_lut(int cmap_id);
+
+        /** Color a row of n power values in one pass: the gray level of x is (x + offset) * scale,
+         *  or (log10(x) + offset) * scale if log_scale, rounded and saturated to [0, 255] as when converting
+         *  to 8-bit (non-positive x in log scale and NAN are level 0); writes n BGR pixels to out */
+        void colorize(const float * in, uint8_t * out, int n, float offset, float scale, bool log_scale,
+                      const ColorLUT & lut);
+
+        /** Histogram of float values (e.g. plot pixels) for finding percentiles, in logarithmic bins:
+         *  the bin of a positive value is the top bits of its representation (1/16 octave wide),
+         *  so no range needs to be known in advance. Values <= 0 are counted as 0; NAN is ignored */
+        class LogHistogram {
+        public:
+            LogHistogram();
+
+            /** Add n values */
+            void add(const float * x, int n);
+
+            /** Add the values of another histogram */
+            void merge(const LogHistogram & other);
+
+            /** Number of values */
+            int64_t size() const;
+
+            /** Approximate p-th percentile (0 <= p <= 100) of the values (interpolated within its bin,
+             *  exact for 0 and 100), NAN if there are no values */
+            float percentile(double p) const;
+
+        private:
+            /* bits of a float's representation below its bin; number of bins (up to +infinity) */
+            static const int SHIFT = 19, BINS = (0x7f800000 >> SHIFT) + 1;
+            std::vector<uint32_t> counts;
+            int64_t n_zero = 0, n = 0;
+            float min_val = FLT_MAX, max_val = 0.f;
+        };
+
+        /** Cache of rasterized text labels, keyed by text and font scale, so that labels drawn on every frame
+         *  (e.g. axis labels) are not rasterized again. Labels are drawn as by cv::putText with font 0
+         *  (FONT_HERSHEY_SIMPLEX), thickness 1 and 8-connected lines */
+        class LabelCache {
+        public:
+            /** Draw text on img with the bottom-left corner of the text at org, in the given color */
+            void draw(cv::Mat & img, const std::string & text, cv::Point org, double font_scale,
+                      const cv::Scalar & color);
+
+        private:
+            /* pixels drawn (nonzero) and the position of the text origin among them */
+            struct Label {
+                cv::Mat mask;
+                cv::Point org;
+            };
+
+            /* most labels kept; all are dropped past this (e.g. after many tick values while panning) */
+            static const size_t MAX_LABELS;
+            std::map<std::pair<std::string, double>, Label> labels;
+        };
+
         /** Rounds a double to the given number of digits and returns as a string */
         std::string round(double dbl, int digs);
    }
@@ -0,0 +1,137 @@
+#pragma once
+#include<vector>
+
+namespace watplot {
+    /** Prefix-sum table of a view: entry (r, c) holds the sum of the bins at rows <= r and columns <= c
+     *  (frequency x time, with the padding of BLFile::view's output). Built from left to right, a few columns at a time.
+     *  DOUBLE storage keeps every entry as a double. FLOAT storage keeps, for each entry, the float32 sum
+     *  of the bins within its TILE x TILE tile, plus (as doubles) the entries along tile boundaries,
+     *  from which it is reconstructed: about 4.25 bytes per entry, with an error relative to the sum of
+     *  one tile rather than to the sum of the whole view.
+     *  A table may be only partly filled: columns not yet added read as the last column added
+     *  (i.e. as if all their bins were zero), and may be added later as more data becomes available. */
+    class ViewTable {
+    public:
+        /** Storage types */
+        enum Storage {
+            DOUBLE, FLOAT
+        };
+
+        /** A column of the table, for fast repeated lookups (see column()) */
+        struct Column {
+            // DOUBLE: entries of the column
+            const double * data;
+            // FLOAT: per tile row, entry at the top of the tile row minus entry at the tile's left boundary
+            const double * offsets;
+            // FLOAT: entries at the tile's left boundary
+            const double * boundary;
+            // FLOAT: sums local to the tile
+            const float * local;
+
+            /** Entry at row r */
+            inline double at(int64_t r) const {
+                return data ? data[r] : offsets[r >> TILE_SHIFT] + boundary[r] + local[r];
+            }
+        };
+
+        /** The samples a table was built from, in file order indices (see BLFile::view) */
+        struct Source {
+            // first sample and bin size along time, frequency
+            int64_t t_lo, t_step, f_lo, f_step;
+            // end of the frequency range
+            int64_t f_hi;
+            // samples [t_lo, t_end) have been added to the table
+            int64_t t_end;
+        };
+
+        explicit ViewTable(Storage storage = DOUBLE) : _storage(storage) { }
+
+        /** Start building a table of rows x cols entries; columns are then added with push_column */
+        void begin(int64_t rows, int64_t cols);
+
+        /** Add the next n columns of bins (n contiguous columns of rows values, each divided by 'area'),
+         *  in parallel on the shared ThreadPool */
+        void push_columns(const double * bins, int64_t n, double area);
+
+        /** Add the next column of bins */
+        inline void push_column(const double * bins, double area) {
+            push_columns(bins, 1, area);
+        }
+
+        /** Remember the current end of the table, so that columns added after this may be replaced
+          * (e.g. a time bin holding only part of its samples, which will be added again once complete) */
+        void mark();
+
+        /** Remove the columns added since the last mark(), if any */
+        void rewind();
+
+        /** Entry (r, c) */
+        double operator()(int64_t r, int64_t c) const;
+
+        /** Get column c; offsets_buf must have room for tile_rows() values and stay valid while the column is used */
+        Column column(int64_t c, double * offsets_buf) const;
+
+        /** Number of rows of tiles (size of the buffer needed by column()) */
+        inline int64_t tile_rows() const {
+            return (_rows + TILE - 1) >> TILE_SHIFT;
+        }
+
+        inline int64_t rows() const {
+            return _rows;
+        }
+
+        inline int64_t cols() const {
+            return _cols;
+        }
+
+        /** Number of columns added so far */
+        inline int64_t filled() const {
+            return _n_pushed;
+        }
+
+        inline Storage storage() const {
+            return _storage;
+        }
+
+        void swap(ViewTable & other);
+
+        /** Free all memory */
+        void clear();
+
+        /** Samples the table was built from (set by BLFile::view) */
+        Source source = Source();
+
+        /** Approximate memory used per entry by a storage type, in bytes */
+        static double bytes_per_entry(Storage storage);
+
+        /** log2 of the size of a tile (FLOAT storage) */
+        static const int TILE_SHIFT = 6;
+        static const int64_t TILE = 1 << TILE_SHIFT;
+
+    private:
+        Storage _storage;
+        int64_t _rows = 0, _cols = 0, _n_pushed = 0;
+
+        /** DOUBLE: entries */
+        std::vector<double> data;
+
+        /** FLOAT: sums within tiles */
+        std::vector<float> local;
+
+        /** FLOAT: entries on the left boundary of each column of tiles (rows x tile columns) */
+        std::vector<double> boundary;
+
+        /** FLOAT: entries on the top boundary of each row of tiles (tile rows x cols) */
+        std::vector<double> top;
+
+        /** column last added */
+        std::vector<double> cur;
+
+        /** column last added, and number of columns added, at the last mark() (-1 if none) */
+        std::vector<double> marked;
+        int64_t _n_marked = -1;
+
+        /** scratch space for push_columns: prefix sums within each new column */
+        std::vector<double> scan;
+    };
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include "util.hpp"
 #include "renderer.hpp"
+#include "threadpool.hpp"
 
 namespace watplot {
     /** Renderer for interactive waterfall plot */
@@ -32,194 +33,309 @@ namespace watplot {
                 render_rect = init_render_rect;
             }
 
-            int64_t dtype_wid = sizeof(double);
-            int64_t mem_limit = consts::MEMORY / dtype_wid;
+            double dtype_wid = ViewTable::bytes_per_entry(view_storage);
+            // (the rest of the memory budget is left to the tile cache)
+            double mem_limit = consts::MEMORY / 4 / dtype_wid;
             // find appropriate amount of memory to allocate
             view_scale_x = static_cast<int>(sqrt(mem_limit / plot_size.area()));
             view_scale_y = view_scale_x;
-            // support very skinny data
-            if (plot_size.height * view_scale_x > file->nints) {
+            // support very skinny data (in tail mode, or while the file holds no data yet, the time axis keeps growing)
+            if (!file->tail_mode && file->nints > 0 && plot_size.height * view_scale_x > file->nints) {
                 view_scale_x = static_cast<double>(file->nints) / plot_size.height;
-                view_scale_y = floor(mem_limit / (file->nints * dtype_wid)) / plot_size.width;
+                view_scale_y = floor(mem_limit / file->nints) / plot_size.width;
             }
-            else if (plot_size.width * view_scale_y > file->header.nchans) {
-                view_scale_y = file->header.nchans / plot_size.width;
-                view_scale_x = floor(mem_limit / (file->header.nchans * dtype_wid)) / plot_size.height;
+            else if (plot_size.width * view_scale_y > file->nchans_shown) {
+                view_scale_y = static_cast<double>(file->nchans_shown) / plot_size.width;
+                view_scale_x = floor(mem_limit / file->nchans_shown) / plot_size.height;
+            }
+
+            data_rect = file->get_full_rect();
+            sample_size = cv::Point2d(file->timestamps.step(), file->freqs.step());
+
+            // optional on-disk tile cache, shared between sessions (not for files still being written)
+            const char * store_dir = std::getenv("WATPLOT_TILE_CACHE");
+            if (store_dir != nullptr && *store_dir && !file->tail_mode) {
+                tiles.open_store(store_dir, file->data_id());
             }
 
             color_scale = NAN;
             log_color_scale = NAN;
         }
 
+        ~WaterfallRenderer() {
+            stop_loader();
+        }
+
+        /** Tail mode: pick up data appended to the file (see BLFile::tail_mode), adding it to the current view
+          * and re-rendering, with the render following the end of the data. Call when the file has changed
+          * (the file type must have refresh())
+          * @return false if the file could not be refreshed because a view is being loaded (try again later) */
+        bool tail() {
+            int64_t n_new = file->refresh();
+            if (n_new <= 0) return n_new == 0;
+            std::cerr << "Waterfall-render: " << n_new << " new time samples\n";
+            file->extend_view(view);
+            invalidate_pixels();
+            data_appended(file->get_full_rect());
+            return true;
+        }
+
     protected:
         /** Render to an image of size plot_size
           * @param recompute_view 2=force recompute; 0=force use old view; 1=smart
           * @param rendered image. CV_8UC3
           */
         virtual cv::Mat _render(int recompute_view = 1) override {
-            if (recompute_view == 2) {
-                // placeholder implementation, if recompute_view=1 should recompute when needed
-                view_rect = file->view(render_rect, view,
-                    static_cast<int>(plot_size.height * view_scale_x),
-                    static_cast<int>(plot_size.width * view_scale_y));
-                update_dxy();
-                std::cerr << "Waterfall-render: Updated view\n";
-            }
-
-            cv::Mat wat_raw(plot_size, CV_32F), wat_gray, wat_color;
-            std::vector<std::thread> thd_mgr;
-            static const unsigned int N_THREADS = std::thread::hardware_concurrency();
-
-            auto worker = [&](unsigned int i) {
-                cv::Point2i pt;
-                for (pt.y = int(i); pt.y < wat_raw.rows; pt.y += N_THREADS) {
-                    float * ptr = wat_raw.ptr<float>(pt.y);
-                    for (pt.x = 0; pt.x < wat_raw.cols; ++pt.x) {
-                        ptr[pt.x] = compute_pixel(pt);
-                    }
-                }
-            };
-            for (unsigned int i = 0; i < N_THREADS; ++i) {
-                thd_mgr.emplace_back(worker, i);
-            }
-            for (unsigned int i = 0; i < N_THREADS; ++i) {
-                thd_mgr[i].join();
-            }
-
-            cv::Point2i pt;
-
-            // initialize color scale, if needed
-            static const float COLOR_FACT = 1.0, MIN_CUTOFF_LOG = 0.1;
-            if (std::isnan(color_scale)) {
-                float min_val = FLT_MAX, max_val = 0.0;
-                for (pt.y = 0; pt.y < wat_raw.rows; ++pt.y) {
-                    float * ptr = wat_raw.ptr<float>(pt.y);
-                    for (pt.x = 0; pt.x < wat_raw.cols; ++pt.x) {
-                        //mean_val += ptr[pt.x] / wat_raw.rows / wat_raw.cols;
-                        max_val = max(ptr[pt.x], max_val);
-                        min_val = min(ptr[pt.x], min_val);
-                    }
-                }
-                if (min_val != 0.0 || max_val != 0.0) {
-                    float min_scaled = log10(max(((1.f - MIN_CUTOFF_LOG) * min_val + MIN_CUTOFF_LOG * max_val), 1e-4));
-                    log_color_scale = 255.f / (log10(max_val) - min_scaled);
-                    log_color_offset = -min_scaled;
-                    color_scale = 255.f / (max_val * COLOR_FACT - min_val / COLOR_FACT);
-                    color_offset = -min_val / COLOR_FACT;
-                }
-            } 
-
-            // scale colors
-            for (pt.y = 0; pt.y < wat_raw.rows; ++pt.y) {
-                float * ptr = wat_raw.ptr<float>(pt.y);
-                for (pt.x = 0; pt.x < wat_raw.cols; ++pt.x) {
-                    if (log_scale) {
-                        ptr[pt.x] = (log10(ptr[pt.x]) + log_color_offset) * log_color_scale;
-                    } else{
-                        ptr[pt.x] = (ptr[pt.x] + color_offset) * color_scale;
-                    }
-                }
-            }
+            update_view(recompute_view);
 
-            // convert to CV_8U format
-            wat_raw.convertTo(wat_gray, CV_8U);
-            if (color) {
-                util::applyColorMap(wat_gray, wat_color, false, colormap);
-            }
-            else {
-                cv::cvtColor(wat_gray, wat_color, cv::COLOR_GRAY2BGR);
+            cv::Mat wat_raw;
+            bool levels = need_levels();
+            util::LogHistogram hist;
+            compute_pixels(wat_raw, levels ? &hist : nullptr);
+            if (levels) set_levels(hist);
+
+            // the frame: the waterfall, with (if drawing axes) the spectrum panel below it, and the time series
+            // panel and colorbar to its right, composited in place into the last frame's buffer
+            cv::Size frame_size = plot_size;
+            if (axes) {
+                frame_size += cv::Size(TS_BORDER_LEFT + TS_WID + 2 * TS_PAD + CB_BORDER_LEFT + CB_WID,
+                                       SPECTRUM_BORDER_TOP + SPECTRUM_HEIGHT + 2 * SPECTRUM_PAD);
             }
+            last_render.create(frame_size, CV_8UC3);
+            cv::Mat wat_color = last_render(cv::Rect(0, 0, plot_size.width, plot_size.height));
+
+            // scale colors and apply the color map in one pass
+            float offset = log_scale ? log_color_offset : color_offset;
+            float scale = log_scale ? log_color_scale : color_scale;
+            // (colormap 14: grayscale)
+            const util::ColorLUT & lut = util::color_lut(color ? colormap : 14);
+            ThreadPool::global().parallel_for(0, wat_raw.rows, ROW_BLOCK, [&](int lo, int hi) {
+                for (int y = lo; y < hi; ++y) {
+                    util::colorize(wat_raw.ptr<float>(y), wat_color.ptr<uint8_t>(y), wat_raw.cols,
+                                   offset, scale, log_scale, lut);
+                }
+            });
 
             if (axes) {
                 // axes
                 double dx = render_rect.width / plot_size.height;
                 double dy = render_rect.height / plot_size.width;
                 for (int i = 30; i < wat_color.cols - 10; i += wat_color.cols / 6) {
-                    cv::putText(wat_color, util::round(i * dy + render_rect.y, 2),
+                    labels.draw(wat_color, util::round(i * dy + render_rect.y, 2),
                         cv::Point(i, wat_color.rows - 15),
-                        0, 0.4, cv::Scalar(255, 255, 255));
+                        0.4, cv::Scalar(255, 255, 255));
                 }
                 for (int i = 50; i < wat_color.rows - 10; i += wat_color.rows / 10) {
-                    cv::putText(wat_color, util::round(i * dx + render_rect.x, 2), cv::Point(10, wat_color.rows - i),
-                        0, 0.4, cv::Scalar(255, 255, 255));
+                    labels.draw(wat_color, util::round(i * dx + render_rect.x, 2), cv::Point(10, wat_color.rows - i),
+                        0.4, cv::Scalar(255, 255, 255));
                 }
-                cv::putText(wat_color, "MHz", cv::Point(wat_color.cols - 45, wat_color.rows - 35), 0,
+                labels.draw(wat_color, "MHz", cv::Point(wat_color.cols - 45, wat_color.rows - 35),
                     0.35, cv::Scalar(50, 50, 255));
-                cv::putText(wat_color, "s", cv::Point(74, 30), 0,
+                labels.draw(wat_color, "s", cv::Point(74, 30),
                     0.4, cv::Scalar(50, 50, 255));
 
-                // spectrum
-                const int spectrum_height = 100, spectrum_pad_top_bot = 15, spectrum_border_top = 3;
-                cv::Mat spectrum_gray(spectrum_height + spectrum_pad_top_bot * 2, wat_color.cols, CV_8U), spectrum_color;
-                spectrum_gray = 0;
-                for (int j = 0; j < plot_size.height; j += plot_size.height / 60) {
-                    for (int i = 0; i < plot_size.width; ++i) {
-                        int pix = wat_raw.at<float>(j, i);
-                        int h = static_cast<int>(pix) * spectrum_height / 256;
-                        if (h <= 0 || h >= spectrum_height) continue;
-                        cv::Point pt(i, spectrum_height - h - 1 + spectrum_pad_top_bot);
-                        if (pix > 115) {
-                            spectrum_gray.at<uint8_t>(pt.y-1, pt.x) = pix;
-                            spectrum_gray.at<uint8_t>(pt.y+1, pt.x) = pix;
-                            if (pt.x) spectrum_gray.at<uint8_t>(pt.y, pt.x-1) = pix;
-                            spectrum_gray.at<uint8_t>(pt.y, pt.x+1) = pix;
-                        }
-                        spectrum_gray.at<uint8_t>(pt) = pix;
+                // panels (on black): spectrum below the plot, time series to its right, with its labels below it
+                int panels_wid = TS_BORDER_LEFT + TS_WID + 2 * TS_PAD;
+                last_render(cv::Rect(plot_size.width, 0, panels_wid, last_render.rows)) = cv::Scalar(0, 0, 0);
+                last_render(cv::Rect(0, plot_size.height, plot_size.width, last_render.rows - plot_size.height)) =
+                    cv::Scalar(0, 0, 0);
+                cv::Mat spectrum = last_render(cv::Rect(0, plot_size.height + SPECTRUM_BORDER_TOP,
+                                                        plot_size.width, SPECTRUM_HEIGHT + 2 * SPECTRUM_PAD));
+                cv::Mat time_series = last_render(cv::Rect(plot_size.width + TS_BORDER_LEFT, 0,
+                                                           TS_WID + 2 * TS_PAD, plot_size.height));
+                cv::Mat time_series_labels = last_render(cv::Rect(plot_size.width + TS_BORDER_LEFT,
+                                                                  plot_size.height + SPECTRUM_BORDER_TOP,
+                                                                  TS_WID + 2 * TS_PAD, SPECTRUM_HEIGHT + 2 * SPECTRUM_PAD));
+                _draw_spectrum(spectrum, wat_raw);
+                _draw_time_series(time_series, time_series_labels);
+
+                // colorbar, with a gap to its left
+                _colorbar(last_render.rows).copyTo(last_render(cv::Rect(plot_size.width + panels_wid, 0,
+                                                                        CB_BORDER_LEFT + CB_WID, last_render.rows)));
+            }
+
+            if (!wind_name.empty()) {
+                cv::imshow(wind_name, last_render);
+            }
+            return last_render;
+        }
+
+        /** Add data appended to the file while the view was loading (tail mode) */
+        virtual void _view_swapped() override {
+            if (file->tail_mode) file->extend_view(view);
+        }
+
+        /** Load a view from the file, through the tile cache (called on the loader thread) */
+        virtual cv::Rect2d _load_view(const cv::Rect2d & rect, ViewTable & out, int max_wid, int max_hi) override {
+            cv::Rect2d loaded = file->view(rect, out, max_wid, max_hi, &tiles);
+            std::cerr << "Waterfall-render: Loaded view\n";
+            return loaded;
+        }
+
+    private:
+        /** Draw the spectrum panel: the mean power over the plotted time range at each plot column (frequency),
+          * and the highest and lowest pixel of each column (max-hold and min over the plotted time bins) */
+        void _draw_spectrum(cv::Mat & panel, const cv::Mat & wat_raw) {
+            const int wid = plot_size.width;
+            std::vector<float> mean(wid);
+            compute_spectrum(mean.data());
+            typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMajorMatrixXf;
+            Eigen::Map<const RowMajorMatrixXf> pixels(wat_raw.ptr<float>(), wat_raw.rows, wat_raw.cols);
+            Eigen::RowVectorXf max_hold = pixels.colwise().maxCoeff(), min_hold = pixels.colwise().minCoeff();
+
+            const float * curves[3] = { max_hold.data(), min_hold.data(), mean.data() };
+            const cv::Scalar colors[3] = { MAX_HOLD_COLOR, MIN_HOLD_COLOR, CURVE_COLOR };
+            double lo, hi;
+            if (_panel_range(curves, 3, wid, lo, hi)) {
+                std::vector<cv::Point2d> pts(wid);
+                for (int k = 0; k < 3; ++k) {
+                    for (int x = 0; x < wid; ++x) {
+                        double v = _panel_value(curves[k][x], lo);
+                        pts[x] = cv::Point2d(x + 0.5, SPECTRUM_PAD + (hi - v) / (hi - lo) * SPECTRUM_HEIGHT);
                     }
+                    _draw_curve(panel, pts, colors[k]);
                 }
-                if (color) {
-                    util::applyColorMap(spectrum_gray, spectrum_color, false, colormap);
-                }
-                else {
-                    cv::cvtColor(spectrum_gray, spectrum_color, cv::COLOR_GRAY2BGR);
-                }
-                cv::putText(spectrum_color, "Spectrum", cv::Point(10, spectrum_color.rows - 15), 0, 0.35,
-                    cv::Scalar(50, 50, 255));
-                cv::vconcat(cv::Mat::zeros(spectrum_border_top, spectrum_color.cols, CV_8UC3), spectrum_color, spectrum_color);
-                cv::vconcat(wat_color, spectrum_color, wat_color);
-
-                // colorbar
-                const int cb_wid = 67, cb_border_left = 3;
-                cv::Mat cb_gray(wat_color.rows, cb_wid, CV_8U), cb_color;
-                int cb_step = cb_gray.rows / 255;
-                for (int i = 0; i < cb_gray.rows; ++i) {
-                    cb_gray.row(i) = 255 - i / cb_step;
-                }
-                if (color) {
-                    util::applyColorMap(cb_gray, cb_color, false, colormap);
-                }
-                else {
-                    cv::cvtColor(cb_gray, cb_color, cv::COLOR_GRAY2BGR);
-                }
-                for (int i = 30; i < 250; i += 23) {
-                    double power_db;
-                    if (log_scale) {
-                        power_db = 10 * (i / log_color_scale - log_color_offset);
-                    } else {
-                        power_db = 10 * log10(i / color_scale - color_offset);
-                    }
-                    if (std::isnan(power_db)) continue;
-                    cv::putText(cb_color, util::round(power_db, 2),
-                        cv::Point(10, cb_color.rows * (255 - i) / 255 + 5), 0, 0.4, cv::Scalar(255, 255, 255));
+                std::string unit = log_scale ? " dB" : "";
+                labels.draw(panel, util::round(hi, 2) + unit, cv::Point(wid - 75, SPECTRUM_PAD - 4), 0.35, LABEL_COLOR);
+                labels.draw(panel, util::round(lo, 2) + unit, cv::Point(wid - 75, panel.rows - 3), 0.35, LABEL_COLOR);
+            }
+            labels.draw(panel, "Spectrum", cv::Point(10, panel.rows - 3), 0.35, TITLE_COLOR);
+            labels.draw(panel, "mean", cv::Point(70, panel.rows - 3), 0.35, CURVE_COLOR);
+            labels.draw(panel, "max", cv::Point(105, panel.rows - 3), 0.35, MAX_HOLD_COLOR);
+            labels.draw(panel, "min", cv::Point(133, panel.rows - 3), 0.35, MIN_HOLD_COLOR);
+        }
+
+        /** Draw the time series panel: the mean power over the plotted band at each plot row (time),
+          * with its title and range on label_panel */
+        void _draw_time_series(cv::Mat & panel, cv::Mat & label_panel) {
+            const int hi_y = plot_size.height;
+            std::vector<float> power(hi_y);
+            compute_time_series(power.data());
+
+            const float * curves[1] = { power.data() };
+            double lo, hi;
+            labels.draw(label_panel, "Power", cv::Point(10, 20), 0.35, TITLE_COLOR);
+            if (!_panel_range(curves, 1, hi_y, lo, hi)) return;
+            std::vector<cv::Point2d> pts(hi_y);
+            for (int y = 0; y < hi_y; ++y) {
+                double v = _panel_value(power[y], lo);
+                pts[y] = cv::Point2d(TS_PAD + (v - lo) / (hi - lo) * TS_WID, y + 0.5);
+            }
+            _draw_curve(panel, pts, CURVE_COLOR);
+            std::string unit = log_scale ? " dB" : "";
+            labels.draw(label_panel, "low: " + util::round(lo, 2) + unit, cv::Point(10, 40), 0.35, LABEL_COLOR);
+            labels.draw(label_panel, "high: " + util::round(hi, 2) + unit, cv::Point(10, 55), 0.35, LABEL_COLOR);
+        }
+
+        /** Power x as plotted on the panels: in dB in log scale, else linear; below (e.g. the bottom of the
+          * panel) if not finite there (e.g. log of 0) */
+        double _panel_value(float x, double below) const {
+            double v = log_scale ? 10.0 * std::log10(x) : x;
+            return std::isfinite(v) ? v : below;
+        }
+
+        /** Range [lo, hi] of the panel values of n_curves curves of n points; false if none is finite */
+        bool _panel_range(const float * const * curves, int n_curves, int n, double & lo, double & hi) const {
+            lo = INFINITY;
+            hi = -INFINITY;
+            for (int k = 0; k < n_curves; ++k) {
+                for (int i = 0; i < n; ++i) {
+                    double v = _panel_value(curves[k][i], NAN);
+                    if (std::isnan(v)) continue;
+                    lo = min(lo, v);
+                    hi = max(hi, v);
                 }
+            }
+            if (lo > hi) return false;
+            if (lo == hi) {
+                // flat: centered
+                lo -= 1.0;
+                hi += 1.0;
+            }
+            return true;
+        }
 
-                cv::putText(cb_color, "dB", cv::Point(cb_color.cols - 38, cb_color.rows - 15), 0,
-                    0.4, cv::Scalar(50, 50, 255));
+        /** Draw an anti-aliased polyline through pts (at sub-pixel positions) */
+        static void _draw_curve(cv::Mat & img, const std::vector<cv::Point2d> & pts, const cv::Scalar & color) {
+            const int shift = 4;
+            std::vector<cv::Point> pts_fixed(pts.size());
+            for (size_t i = 0; i < pts.size(); ++i) {
+                pts_fixed[i] = cv::Point(static_cast<int>(std::lround(pts[i].x * (1 << shift))),
+                                         static_cast<int>(std::lround(pts[i].y * (1 << shift))));
+            }
+            cv::polylines(img, pts_fixed, false, color, 1, cv::LINE_AA, shift);
+        }
 
-                // leave a gap to left of colorbar
-                cv::hconcat(cv::Mat::zeros(cb_color.rows, cb_border_left, CV_8UC3), cb_color, cb_color);
-                cv::hconcat(wat_color, cb_color, wat_color);
+        /** Colorbar for the current colors, of the given height, with the gap to its left
+          * (cached until the colors or the height change) */
+        const cv::Mat & _colorbar(int rows) {
+            int cmap = color ? colormap : 14;
+            double scale = log_scale ? log_color_scale : color_scale;
+            double offset = log_scale ? log_color_offset : color_offset;
+            if (!colorbar.empty() && colorbar.rows == rows && colorbar_cmap == cmap && colorbar_log_scale == log_scale &&
+                colorbar_scale == scale && colorbar_offset == offset) {
+                return colorbar;
             }
+            colorbar_cmap = cmap;
+            colorbar_log_scale = log_scale;
+            colorbar_scale = scale;
+            colorbar_offset = offset;
 
-            last_render = wat_color;
-            if (!wind_name.empty()) {
-                cv::imshow(wind_name, wat_color);
+            colorbar.create(rows, CB_BORDER_LEFT + CB_WID, CV_8UC3);
+            colorbar = cv::Scalar(0, 0, 0);
+            cv::Mat cb_color = colorbar(cv::Rect(CB_BORDER_LEFT, 0, CB_WID, rows));
+            const util::ColorLUT & lut = util::color_lut(cmap);
+            int cb_step = max(rows / 255, 1);
+            for (int i = 0; i < rows; ++i) {
+                const uint8_t * bgr = lut.bgr[max(255 - i / cb_step, 0)];
+                cb_color.row(i) = cv::Scalar(bgr[0], bgr[1], bgr[2]);
             }
-            return wat_color;
+            for (int i = 30; i < 250; i += 23) {
+                double power_db;
+                if (log_scale) {
+                    power_db = 10 * (i / log_color_scale - log_color_offset);
+                } else {
+                    power_db = 10 * log10(i / color_scale - color_offset);
+                }
+                if (std::isnan(power_db)) continue;
+                labels.draw(cb_color, util::round(power_db, 2),
+                    cv::Point(10, rows * (255 - i) / 255 + 5), 0.4, cv::Scalar(255, 255, 255));
+            }
+            labels.draw(cb_color, "dB", cv::Point(CB_WID - 38, rows - 15), 0.4, cv::Scalar(50, 50, 255));
+            return colorbar;
         }
 
-    private:
+        /** Overlay layout: colorbar width and gap to its left; spectrum height, padding above and below
+          * the plotted range, and gap above it */
+        static const int CB_WID = 67, CB_BORDER_LEFT = 3;
+        static const int SPECTRUM_HEIGHT = 100, SPECTRUM_PAD = 15, SPECTRUM_BORDER_TOP = 3;
+        /** Time series panel width, padding left and right of the plotted range, and gap to its left */
+        static const int TS_WID = 100, TS_PAD = 15, TS_BORDER_LEFT = 3;
+
+        /** Colors of the panels' curves and text (BGR) */
+        static const cv::Scalar CURVE_COLOR, MAX_HOLD_COLOR, MIN_HOLD_COLOR, TITLE_COLOR, LABEL_COLOR;
+
         /** Pointer to file to plot */
         const std::shared_ptr<BLFileType> file;
+
+        /** Rasterized labels of the axes, colorbar and spectrum */
+        util::LabelCache labels;
+
+        /** Cached colorbar (see _colorbar) and the colors it was drawn with */
+        cv::Mat colorbar;
+        int colorbar_cmap = -1;
+        bool colorbar_log_scale = false;
+        double colorbar_scale = NAN, colorbar_offset = NAN;
     };
+
+    template <class BLFileType>
+    const cv::Scalar WaterfallRenderer<BLFileType>::CURVE_COLOR(255, 255, 255);
+    template <class BLFileType>
+    const cv::Scalar WaterfallRenderer<BLFileType>::MAX_HOLD_COLOR(0, 190, 255);
+    template <class BLFileType>
+    const cv::Scalar WaterfallRenderer<BLFileType>::MIN_HOLD_COLOR(255, 190, 0);
+    template <class BLFileType>
+    const cv::Scalar WaterfallRenderer<BLFileType>::TITLE_COLOR(50, 50, 255);
+    template <class BLFileType>
+    const cv::Scalar WaterfallRenderer<BLFileType>::LABEL_COLOR(255, 255, 255);
 }
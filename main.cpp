@@ -2,6 +2,7 @@
 #include "core.hpp"
 #include "util.hpp"
 #include "fsutil.hpp"
+#include "filewatcher.hpp"
 
 namespace {
     const char VERSION[] = "0.1.3 alpha";
@@ -35,6 +36,8 @@ namespace {
             else if (event == cv::EVENT_RBUTTONDOWN)
             {
                 rect = watrend->render_rect;
+                // colors set by hand: stop tracking auto-levels
+                watrend->track_levels = false;
                 init_log_scale = watrend->log_scale;
                 if (init_log_scale) {
                     color_scale = watrend->log_color_scale;
@@ -75,7 +78,7 @@ namespace {
             cv::Rect2d new_rect(rect.x - (p.x - rect.x) * (scale - 1.0), rect.y - (p.y - rect.y) * (scale - 1.0),
                 rect.width * scale, rect.height * scale);
             watrend->render_rect = new_rect;
-            watrend->render();
+            watrend->render_interactive();
         }
         else if (event == cv::EVENT_MOUSEMOVE)
         {
@@ -100,14 +103,14 @@ namespace {
                             rect.y - (p.y - rect.y) * (scaley - 1.0),
                             rect.width * scalex, rect.height * scaley);
                     watrend->render_rect = new_rect;
-                    watrend->render();
+                    watrend->render_interactive();
 
                 } else {
                     // pan
                     cv::Rect2d new_rect(rect.x + (y - mouse_down_y) * scalex, rect.y - (x - mouse_down_x) * scaley,
                         rect.width, rect.height);
                     watrend->render_rect = new_rect;
-                    watrend->render();
+                    watrend->render_interactive();
                 }
             }
             else if (mouse_down == 2) {
@@ -119,7 +122,7 @@ namespace {
                     watrend->color_scale = color_scale * (1.0 + (y - mouse_down_y) * 1e-3);
                     watrend->color_offset = color_offset + (x - mouse_down_x) * 1e6;
                 }
-                watrend->render();
+                watrend->render_interactive();
             }
             /*
             else if (mouse_down == 3) {
@@ -130,6 +133,81 @@ namespace {
         }
     }
 
+    /** helper for checking if a command line argument is a range value (number, optionally followed by '%') */
+    bool is_range_arg(const char * str) {
+        char * end;
+        std::strtod(str, &end);
+        return end != str && (*end == 0 || (*end == '%' && end[1] == 0));
+    }
+
+    /** helper for listing the data files (.fil, .h5, .hdf5) in a directory, sorted by name
+     *  (and those in its subdirectories, after its own files, if recursive; symlinked subdirectories are skipped)
+     *  @return false if path is not a directory */
+    bool list_data_files(const std::string & path, std::vector<std::string> & out, bool recursive = false) {
+        tinydir_dir dir;
+        if (tinydir_open_sorted(&dir, path.c_str()) == -1) return false;
+        std::vector<std::string> subdirs;
+        for (size_t i = 0; i < dir.n_files; ++i) {
+            tinydir_file file;
+            tinydir_readfile_n(&dir, &file, i);
+            if (file.is_dir) {
+                std::string name = file.name;
+                if (!recursive || name == "." || name == "..") continue;
+#ifndef _WIN32
+                // do not follow symlinked directories (a link to a parent would recurse forever)
+                struct stat st;
+                if (lstat(file.path, &st) == 0 && S_ISLNK(st.st_mode)) continue;
+#endif
+                subdirs.push_back(file.path);
+                continue;
+            }
+            std::string ext = file.extension;
+            if (ext == "fil" || ext == "h5" || ext == "hdf5") out.push_back(file.path);
+        }
+        tinydir_close(&dir);
+        for (const std::string & sub : subdirs) list_data_files(sub, out, true);
+        return true;
+    }
+
+    /** helper for parsing the IFs to show: "k" (IF k), "k+l+..." (added up), "k,l,..." (side by side),
+     *  "I" (Stokes I from XX + YY, i.e. 0+1) or "all" (all IFs side by side)
+     *  @return false if str is not valid */
+    bool parse_ifs(const std::string & str, watplot::IFSelection & out) {
+        out = watplot::IFSelection();
+        if (str == "I") {
+            out.mask = 3;
+            return true;
+        }
+        if (str == "all") {
+            out.mask = ~0u;
+            out.side_by_side = true;
+            return true;
+        }
+        out.mask = 0;
+        out.side_by_side = str.find(',') != std::string::npos;
+        if (out.side_by_side && str.find('+') != std::string::npos) return false;
+        std::istringstream ss(str);
+        std::string item;
+        while (std::getline(ss, item, out.side_by_side ? ',' : '+')) {
+            char * end;
+            long k = std::strtol(item.c_str(), &end, 10);
+            if (item.empty() || *end || k < 0 || k >= 32) return false;
+            out.mask |= 1u << k;
+        }
+        return out.mask != 0;
+    }
+
+    /** helper for parsing auto-levels percentiles "low,high" (0 <= low < high <= 100)
+     *  @return false if str is not valid */
+    bool parse_levels(const std::string & str, double & low, double & high) {
+        char * end;
+        low = std::strtod(str.c_str(), &end);
+        if (end == str.c_str() || *end != ',') return false;
+        const char * high_str = end + 1;
+        high = std::strtod(high_str, &end);
+        return end != high_str && !*end && low >= 0.0 && low < high && high <= 100.0;
+    }
+
     double parse_dbl(char * str, double a, double b) {
         size_t len = strlen(str);
         if (len == 0) return 0.0;
@@ -151,21 +229,73 @@ int main(int argc, char** argv) {
 
     std::cout << std::fixed << std::setprecision(17);
     std::cerr << std::fixed << std::setprecision(17);
-    std::cout << "watplot v" << VERSION << " - Interactive Waterfall Plotting Utility\n";
-    std::cout << "(c) Alex Yu / Breakthrough Listen 2019\n\n";
-    std::cout << "formats supported: .fil .h5./hdf5\n";
+
+    // options, anywhere on the command line: --ifs <IFs to show>, --levels <low>,<high>
+    IFSelection if_sel;
+    bool if_given = false;
+    double levels_low = -1.0, levels_high = -1.0;
+    std::vector<char *> args;
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "--ifs") == 0 && i + 1 < argc) {
+            if (!parse_ifs(argv[++i], if_sel)) {
+                std::cerr << "Error: Invalid IF selection: \"" << argv[i] << "\"\n";
+                std::exit(8);
+            }
+            if_given = true;
+        }
+        else if (strcmp(argv[i], "--levels") == 0 && i + 1 < argc) {
+            if (!parse_levels(argv[++i], levels_low, levels_high)) {
+                std::cerr << "Error: Invalid auto-levels percentiles: \"" << argv[i] << "\"\n";
+                std::exit(6);
+            }
+        }
+        else {
+            args.push_back(argv[i]);
+        }
+    }
+    argc = static_cast<int>(args.size());
+    argv = args.data();
 
     bool stat = (argc >= 2 && strcmp(argv[1], "stat") == 0);
+    bool tail = (argc >= 2 && strcmp(argv[1], "tail") == 0);
+    // stat output format: csv, json, or (if not given) the same layout as when loading a file
+    std::string stat_format;
+    if (stat && argc >= 3 && (strcmp(argv[2], "csv") == 0 || strcmp(argv[2], "json") == 0)) stat_format = argv[2];
+    // number of mode arguments before the path
+    int mode = stat + tail + !stat_format.empty();
+
+    // (a machine-readable table is the only thing written to stdout)
+    if (stat_format.empty()) {
+        std::cout << "watplot v" << VERSION << " - Interactive Waterfall Plotting Utility\n";
+        std::cout << "(c) Alex Yu / Breakthrough Listen 2019\n\n";
+        std::cout << "formats supported: .fil .h5./hdf5\n";
+    }
+
+    // data file paths come before the range arguments; several files (or a directory of files)
+    // are stitched into one virtual data file
+    int n_paths = 0;
+    while (1 + mode + n_paths < argc && !is_range_arg(argv[1 + mode + n_paths])) ++n_paths;
+    int range_arg = 1 + mode + n_paths;
+    int n_range = argc - range_arg;
 
-    if (argc != 2 + stat && argc != 4 + stat && argc != 6 + stat) {
-        std::cerr << "\nusage: watplot [stat] <data_file_path> [f_start[%] f_stop[%] [t_start[%] t_stop[%]]]\n\n";
-        std::cerr << "stat: if specified, displays header information without loading (ignores f, t range).\n";
+    if (n_paths < 1 || (n_range != 0 && n_range != 2 && n_range != 4)) {
+        std::cerr << "\nusage: watplot [stat [csv|json]|tail] <data_file_path>... [f_start[%] f_stop[%] [t_start[%] t_stop[%]]]\n"
+                     "               [--ifs <IFs>] [--levels <low>,<high>]\n\n";
+        std::cerr << "stat: if specified, displays header information without loading (ignores f, t range).\n"
+                     "      Directories are searched recursively; csv, json: print a table of all files.\n";
+        std::cerr << "tail: if specified, follows data appended to the file while it is being written (.fil only).\n";
+        std::cerr << "data_file_path: a data file, or several data files/directories of data files to view as one,\n"
+                     "                concatenated in time (same channels) or in frequency (same timestamps).\n";
         std::cerr << "f_start, f_stop: frequency range. Append '%' to use percent of max range of data,\n                 e.g., watplot file 0% 50%.\n";
         std::cerr << "t_start, t_stop: time range.\n";
+        std::cerr << "--ifs: IFs (e.g. polarizations) to show, if the data has several: k (IF k, default 0),\n"
+                     "       k+l (added up), k,l (side by side in frequency), I (0+1, Stokes I from XX+YY), all.\n";
+        std::cerr << "--levels: percentiles of the plot shown at the lowest and highest color (default 1,99.5;\n"
+                     "          0,100: minimum and maximum).\n";
         std::exit(0);
     }
 
-    if (stat && argc != 3) {
+    if (stat && n_range) {
         std::cerr << "WARNING: stat specified, range arguments ignored\n";
     }
 
@@ -179,27 +309,73 @@ int main(int argc, char** argv) {
         "- Right click and drag mouse to adjust colormap (horizontal: shift, vertical: scale)\n"
         "- Press C, Shift + C to cycle through colormaps (15 total)\n"
         "- Press L to toggle log scale\n"
+        "- Press R to reset the color scale to the current plot, T to toggle auto-levels tracking\n"
         "- Press Shift + S to save plot to ./waterfall-NUM.png\n"
         "- Press Q or ESC to exit\n"
         "\n"; }
 
-    std::cout << "Loading data headers, please wait...\n";
+    if (stat_format.empty()) std::cout << "Loading data headers, please wait...\n";
 
-    std::string path = argv[1 + stat];
+    std::vector<std::string> paths;
+    for (int i = 0; i < n_paths; ++i) {
+        if (!list_data_files(argv[1 + mode + i], paths, stat)) paths.push_back(argv[1 + mode + i]);
+    }
+    if (paths.empty()) {
+        std::cerr << "Error: No data files found\n";
+        std::exit(1);
+    }
+
+    if (stat) {
+        // headers only: no window, data mapping or axes
+        auto start_time = std::chrono::high_resolution_clock::now();
+        std::vector<FileInfo> infos = stat_files(paths);
+        if (stat_format == "csv") write_csv(std::cout, infos);
+        else if (stat_format == "json") write_json(std::cout, infos);
+        else for (const FileInfo & info : infos) std::cout << info;
+
+        size_t n_failed = std::count_if(infos.begin(), infos.end(), [](const FileInfo & info) { return !info.ok(); });
+        double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count();
+        std::cerr << "Stat: " << infos.size() << " files (" << n_failed << " unreadable) in " <<
+            util::round(elapsed, 3) << " s\n";
+        return 0;
+    }
+    std::string path = paths[0];
     std::string ext = path.substr(path.find_last_of(".") + 1);
 
-    const std::string WIND_NAME = "Interactive Waterfall Plot - " + std::string(path);
+    std::string WIND_NAME = "Interactive Waterfall Plot - " + std::string(path);
+    if (paths.size() > 1) WIND_NAME += " (+" + std::to_string(paths.size() - 1) + " files)";
     cv::namedWindow(WIND_NAME, cv::WINDOW_NORMAL);
     Renderer::Ptr watrend;
 
     cv::Rect2d default_rect;
-    if (ext == "fil") {
+    // tail mode: picks up data appended to the file, returns false if it should be retried later
+    std::function<bool()> tail_refresh;
+    if (paths.size() > 1) {
+        if (tail) {
+            std::cerr << "Error: tail is only supported for a single .fil file\n";
+            std::exit(5);
+        }
+        Stitched::Ptr st = std::make_shared<Stitched>(paths);
+        if (if_given) st->select_ifs(if_sel);
+        default_rect = st->get_full_rect();
+        watrend = std::make_shared<WaterfallRenderer<Stitched>>(st, WIND_NAME);
+    }
+    else if (ext == "fil") {
         Filterbank::Ptr fb = std::make_shared<Filterbank>(path);
+        if (if_given) fb->select_ifs(if_sel);
         default_rect = fb->get_full_rect();
-        watrend = std::make_shared<WaterfallRenderer<Filterbank>>(fb, WIND_NAME);
+        if (tail) {
+            // views extend past the end of the data; no overview pyramid, since the file keeps changing
+            fb->tail_mode = true;
+            fb->pyramid_factor = 0;
+        }
+        auto fb_rend = std::make_shared<WaterfallRenderer<Filterbank>>(fb, WIND_NAME);
+        tail_refresh = [fb_rend]() { return fb_rend->tail(); };
+        watrend = fb_rend;
     }
     else if (ext == "h5" || ext == "hdf5" ) {
         HDF5::Ptr hdf5 = std::make_shared<HDF5>(path);
+        if (if_given) hdf5->select_ifs(if_sel);
         default_rect = hdf5->get_full_rect();
         watrend = std::make_shared<WaterfallRenderer<HDF5>>(hdf5, WIND_NAME);
     }
@@ -207,19 +383,23 @@ int main(int argc, char** argv) {
         std::cerr << "Error: Unrecognized extension: \"" << ext << "\". Only .h5, .hdf5, .fil supported.\n";
         std::exit(5);
     }
+    if (tail && ext != "fil") {
+        std::cerr << "Error: tail is only supported for .fil files\n";
+        std::exit(5);
+    }
 
-    if (argc >= 4) {
-        double f_start = parse_dbl(argv[2 + stat], default_rect.height, default_rect.y);
-        double f_stop = parse_dbl(argv[3 + stat], default_rect.height, default_rect.y);
+    if (n_range >= 2) {
+        double f_start = parse_dbl(argv[range_arg], default_rect.height, default_rect.y);
+        double f_stop = parse_dbl(argv[range_arg + 1], default_rect.height, default_rect.y);
         if (f_start >= f_stop) {
             std::cerr << "Error: Frequency range is empty!\n";
             std::exit(6);
         }
         default_rect.height = f_stop - f_start;
         default_rect.y = f_start;
-        if (argc >= 6) {
-            double t_start = parse_dbl(argv[4 + stat], default_rect.width, default_rect.x);
-            double t_stop = parse_dbl(argv[5 + stat], default_rect.width, default_rect.x);
+        if (n_range >= 4) {
+            double t_start = parse_dbl(argv[range_arg + 2], default_rect.width, default_rect.x);
+            double t_stop = parse_dbl(argv[range_arg + 3], default_rect.width, default_rect.x);
             default_rect.width = t_stop - t_start;
             default_rect.x = t_start;
             if (t_start >= t_stop) {
@@ -229,8 +409,10 @@ int main(int argc, char** argv) {
         }
     }
 
-    if (stat) { return 0; }
-
+    if (levels_low >= 0.0) {
+        watrend->levels_low = levels_low;
+        watrend->levels_high = levels_high;
+    }
     watrend->render_rect = default_rect;
     watrend->render();
     cv::Mat init_rend = watrend->render(2);
@@ -238,22 +420,36 @@ int main(int argc, char** argv) {
     cv::resizeWindow(WIND_NAME, init_rend.cols, init_rend.rows);
 
     cv::setMouseCallback(WIND_NAME, CallBackFunc, watrend.get());
+    std::unique_ptr<FileWatcher> watcher;
+    bool tail_pending = false;
+    if (tail) watcher.reset(new FileWatcher(path));
     int saveid = 0;
     while (true) {
         int k = cv::waitKey(1);
-        // WASD: pan
+        // show views loaded in the background
+        watrend->poll();
+        // large plots: finish the full-resolution render after a low-resolution preview, once idle
+        watrend->refine();
+        // tail mode: show data appended to the file
+        if (watcher && watcher->changed()) tail_pending = true;
+        if (tail_pending) tail_pending = !tail_refresh();
+        // WASD: pan by about 1/80 of the plot, in whole pixels (only the pixels exposed are computed)
+        double pan_y = max(std::round(watrend->plot_size.width / 80.0), 1.0) *
+                           watrend->render_rect.height / watrend->plot_size.width;
+        double pan_x = max(std::round(watrend->plot_size.height / 80.0), 1.0) *
+                           watrend->render_rect.width / watrend->plot_size.height;
         if (k == 'a') {
-             watrend->render_rect.y -= watrend->render_rect.height / 80.0;
-             watrend->render();
+             watrend->render_rect.y -= pan_y;
+             watrend->render_interactive();
         } else if (k == 'd') {
-             watrend->render_rect.y += watrend->render_rect.height / 80.0;
-             watrend->render();
+             watrend->render_rect.y += pan_y;
+             watrend->render_interactive();
         } else if (k == 's') {
-             watrend->render_rect.x -= watrend->render_rect.width / 80.0;
-             watrend->render();
+             watrend->render_rect.x -= pan_x;
+             watrend->render_interactive();
         } else if (k == 'w') {
-             watrend->render_rect.x += watrend->render_rect.width / 80.0;
-             watrend->render();
+             watrend->render_rect.x += pan_x;
+             watrend->render_interactive();
         } else if (k == 'S') {
             // shift + s: save
             std::string fname = "waterfall-" + util::padleft(++saveid, 3, '0') + ".png";
@@ -265,6 +461,16 @@ int main(int argc, char** argv) {
             watrend->render();
             std::cout << "Log scale: " <<
                 (watrend->log_scale ? "ON" : "OFF") << "\n";
+        } else if (k == 'r') {
+            // r: auto-levels from the current plot
+            watrend->reset_levels();
+            watrend->render();
+        } else if (k == 't') {
+            // t: auto-levels tracking
+            watrend->track_levels ^= 1;
+            watrend->render();
+            std::cout << "Auto-levels tracking: " <<
+                (watrend->track_levels ? "ON" : "OFF") << "\n";
         } else if (k == 61 || k == 45) {
             // = (+) key, - key resp.: zoom
             double scale = k == 61 ? (1.0 - 3e-2) : (1.0 + 3e-2) ;
@@ -273,7 +479,7 @@ int main(int argc, char** argv) {
                     rect.y - (rect.height / 2) * (scale - 1.0),
                     rect.width * scale, rect.height * scale);
             watrend->render_rect = new_rect;
-            watrend->render();
+            watrend->render_interactive();
         } else if (k == '0') {
             // 0: reset scale
             watrend->render_rect = default_rect;
@@ -0,0 +1,110 @@
+#include "stdafx.h"
+#include "mmapfile.hpp"
+
+namespace watplot {
+    MappedFile::~MappedFile() {
+        close();
+    }
+
+    bool MappedFile::open(const std::string & path, int64_t offset, int64_t size) {
+        close();
+#ifdef _WIN32
+        _file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (_file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER file_size;
+        GetFileSizeEx(_file, &file_size);
+        if (size < 0) size = file_size.QuadPart - offset;
+        if (size < 0 || offset + size > file_size.QuadPart) {
+            close();
+            return false;
+        }
+        if (size == 0) {
+            // nothing to map (e.g. a data file holding only its header so far)
+            close();
+            return true;
+        }
+        _mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (_mapping == NULL) {
+            close();
+            return false;
+        }
+        SYSTEM_INFO sys_info;
+        GetSystemInfo(&sys_info);
+        int64_t align = offset % sys_info.dwAllocationGranularity;
+        _base_size = size + align;
+        int64_t base_offset = offset - align;
+        _base = static_cast<char *>(MapViewOfFile(_mapping, FILE_MAP_READ,
+            DWORD(base_offset >> 32), DWORD(base_offset & 0xFFFFFFFF), SIZE_T(_base_size)));
+        if (_base == nullptr) {
+            close();
+            return false;
+        }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st)) {
+            ::close(fd);
+            return false;
+        }
+        if (size < 0) size = static_cast<int64_t>(st.st_size) - offset;
+        if (size < 0 || offset + size > static_cast<int64_t>(st.st_size)) {
+            ::close(fd);
+            return false;
+        }
+        if (size == 0) {
+            // nothing to map (e.g. a data file holding only its header so far)
+            ::close(fd);
+            return true;
+        }
+        // mmap offset must be a multiple of the page size
+        int64_t align = offset % sysconf(_SC_PAGE_SIZE);
+        _base_size = size + align;
+        void * ptr = mmap(NULL, size_t(_base_size), PROT_READ, MAP_SHARED, fd, off_t(offset - align));
+        // the mapping stays valid after the descriptor is closed
+        ::close(fd);
+        if (ptr == MAP_FAILED) return false;
+        _base = static_cast<char *>(ptr);
+#endif
+        _data = _base + align;
+        _size = size;
+        return true;
+    }
+
+    void MappedFile::close() {
+#ifdef _WIN32
+        if (_base != nullptr) UnmapViewOfFile(_base);
+        if (_mapping != NULL) CloseHandle(_mapping);
+        if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+        _mapping = NULL;
+        _file = INVALID_HANDLE_VALUE;
+#else
+        if (_base != nullptr) munmap(_base, size_t(_base_size));
+#endif
+        _base = nullptr;
+        _data = nullptr;
+        _base_size = _size = 0;
+    }
+
+    void MappedFile::advise(Advice advice, int64_t offset, int64_t len) const {
+#ifndef _WIN32
+        if (_base == nullptr) return;
+        if (len < 0 || offset + len > _size) len = _size - offset;
+        if (len <= 0) return;
+        // madvise requires a page-aligned start address
+        int64_t page = sysconf(_SC_PAGE_SIZE);
+        int64_t start = (_data - _base) + offset;
+        int64_t align = start % page;
+        int flag = MADV_NORMAL;
+        switch (advice) {
+        case SEQUENTIAL: flag = MADV_SEQUENTIAL; break;
+        case RANDOM: flag = MADV_RANDOM; break;
+        case WILLNEED: flag = MADV_WILLNEED; break;
+        default: break;
+        }
+        madvise(_base + start - align, size_t(len + align), flag);
+#endif
+        // no equivalent hints on Windows; the mapping works regardless
+    }
+}
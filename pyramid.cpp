@@ -0,0 +1,263 @@
+#include "stdafx.h"
+#include "pyramid.hpp"
+
+namespace {
+    const char PYRAMID_MAGIC[8] = { 'W', 'A', 'T', 'P', 'Y', 'R', '1', '\0' };
+
+    /* helper for writing one int64 field */
+    void _write_i64(std::ofstream & ofs, int64_t val) {
+        ofs.write((const char *)&val, sizeof(val));
+    }
+
+    /* helper for reading one int64 field */
+    int64_t _read_i64(std::ifstream & ifs) {
+        int64_t val = -1;
+        ifs.read((char *)&val, sizeof(val));
+        return val;
+    }
+
+    /* round up to multiple of 8 bytes, so that all levels are aligned for doubles */
+    int64_t _pad8(int64_t x) {
+        return (x + 7) / 8 * 8;
+    }
+
+    /* size of sidecar header in bytes */
+    int64_t _header_bytes(const std::string & path, size_t n_levels) {
+        return sizeof(PYRAMID_MAGIC) + 7 * sizeof(int64_t) + _pad8(path.size()) + n_levels * 5 * sizeof(int64_t);
+    }
+}
+
+namespace watplot {
+    const int64_t Pyramid::MIN_DATA_BYTES = 1LL << 30;
+    const int64_t Pyramid::MAX_BASE_BYTES = 1LL << 28;
+    const int64_t Pyramid::MIN_BINS = 256;
+    const double Pyramid::MAX_ROUNDING = 0.25;
+    const std::string Pyramid::SIDECAR_EXT = ".watpyr";
+
+    bool Pyramid::open(const std::string & path, int64_t data_size_bytes, int64_t nints, int64_t nchans,
+                       const BinFunc & bin, int factor, const std::string & variant) {
+        close();
+        if (data_size_bytes < MIN_DATA_BYTES || factor < 2) return false;
+
+        struct stat st;
+        if (stat(path.c_str(), &st)) return false;
+        int64_t file_size = static_cast<int64_t>(st.st_size), mtime = static_cast<int64_t>(st.st_mtime);
+
+        _plan(nints, nchans, factor);
+        const std::string sidecar = path + variant + SIDECAR_EXT;
+        if (!_load(sidecar, path, file_size, mtime, nints, nchans, factor)) {
+            _build(sidecar, path, file_size, mtime, nints, nchans, factor, bin);
+        }
+        return true;
+    }
+
+    void Pyramid::close() {
+        levels.clear();
+        sidecar_map.close();
+    }
+
+    int Pyramid::find_level(int64_t t_step, int64_t f_step) const {
+        for (int i = static_cast<int>(levels.size()) - 1; i >= 0; --i) {
+            const Level & lv = levels[i];
+            if (lv.fac_t > t_step || lv.fac_f > f_step) continue;
+            int64_t t_rounded = (t_step + lv.fac_t - 1) / lv.fac_t * lv.fac_t;
+            int64_t f_rounded = (f_step + lv.fac_f - 1) / lv.fac_f * lv.fac_f;
+            if (t_rounded <= t_step * (1.0 + MAX_ROUNDING) && f_rounded <= f_step * (1.0 + MAX_ROUNDING)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    int Pyramid::find_aligned_level(int64_t t_lo, int64_t t_step, int64_t f_lo, int64_t f_step) const {
+        for (int i = static_cast<int>(levels.size()) - 1; i >= 0; --i) {
+            const Level & lv = levels[i];
+            if (t_lo % lv.fac_t == 0 && t_step % lv.fac_t == 0 && f_lo % lv.fac_f == 0 && f_step % lv.fac_f == 0) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void Pyramid::view(int level, Eigen::MatrixXd & out, int64_t t_lo, int64_t t_hi, int64_t t_step,
+                       int64_t f_lo, int64_t f_hi, int64_t f_step) const {
+        const Level & lv = levels[level];
+        int64_t out_hi = (f_hi - f_lo) / f_step;
+
+        // convert to indices into the level
+        int64_t lt_lo = t_lo / lv.fac_t, lt_step = t_step / lv.fac_t;
+        int64_t lf_lo = f_lo / lv.fac_f, lf_step = f_step / lv.fac_f;
+        int64_t lt_hi = min((t_hi + lv.fac_t - 1) / lv.fac_t, lv.n_t);
+        int64_t lf_hi = min((f_hi + lv.fac_f - 1) / lv.fac_f, lv.n_f);
+
+        out.setZero();
+        for (int64_t t = lt_lo; t < lt_hi; ++t) {
+            const double * in = lv.data + t * lv.n_f;
+            double * out_data = out.data() + ((t - lt_lo) / lt_step + 1) * (out_hi + 2) + 1;
+            for (int64_t f = lf_lo; f < lf_hi; ++f) {
+                out_data[(f - lf_lo) / lf_step] += in[f];
+            }
+        }
+    }
+
+    void Pyramid::_plan(int64_t nints, int64_t nchans, int factor) {
+        levels.clear();
+
+        // finest level: downsample the longer axis until it fits in MAX_BASE_BYTES
+        Level lv;
+        lv.fac_t = lv.fac_f = 1;
+        lv.n_t = nints;
+        lv.n_f = nchans;
+        lv.offset = 0;
+        lv.data = nullptr;
+        while (lv.n_t * lv.n_f * int64_t(sizeof(double)) > MAX_BASE_BYTES) {
+            if (lv.n_f >= lv.n_t) lv.fac_f *= factor;
+            else lv.fac_t *= factor;
+            lv.n_t = (nints + lv.fac_t - 1) / lv.fac_t;
+            lv.n_f = (nchans + lv.fac_f - 1) / lv.fac_f;
+        }
+        levels.push_back(lv);
+
+        // coarser levels: downsample every axis which is still long enough
+        while (true) {
+            bool downsampled = false;
+            if (lv.n_t > MIN_BINS) {
+                lv.fac_t *= factor;
+                downsampled = true;
+            }
+            if (lv.n_f > MIN_BINS) {
+                lv.fac_f *= factor;
+                downsampled = true;
+            }
+            if (!downsampled) break;
+            lv.n_t = (nints + lv.fac_t - 1) / lv.fac_t;
+            lv.n_f = (nchans + lv.fac_f - 1) / lv.fac_f;
+            levels.push_back(lv);
+        }
+    }
+
+    bool Pyramid::_load(const std::string & sidecar, const std::string & path, int64_t file_size, int64_t mtime,
+                        int64_t nints, int64_t nchans, int factor) {
+        std::ifstream ifs(sidecar, std::ios::in | std::ios::binary);
+        if (!ifs) return false;
+
+        char magic[sizeof(PYRAMID_MAGIC)];
+        ifs.read(magic, sizeof(magic));
+        if (!ifs || memcmp(magic, PYRAMID_MAGIC, sizeof(magic))) return false;
+
+        // check key and parameters
+        if (_read_i64(ifs) != file_size || _read_i64(ifs) != mtime ||
+            _read_i64(ifs) != nints || _read_i64(ifs) != nchans || _read_i64(ifs) != factor ||
+            _read_i64(ifs) != static_cast<int64_t>(levels.size())) {
+            return false;
+        }
+        int64_t path_len = _read_i64(ifs);
+        if (path_len != static_cast<int64_t>(path.size())) return false;
+        std::string stored_path(_pad8(path_len), '\0');
+        ifs.read(&stored_path[0], stored_path.size());
+        if (stored_path.compare(0, path_len, path)) return false;
+
+        int64_t end = 0;
+        for (Level & lv : levels) {
+            if (_read_i64(ifs) != lv.fac_t || _read_i64(ifs) != lv.fac_f ||
+                _read_i64(ifs) != lv.n_t || _read_i64(ifs) != lv.n_f) {
+                return false;
+            }
+            lv.offset = _read_i64(ifs);
+            end = max(end, lv.offset + lv.n_t * lv.n_f * int64_t(sizeof(double)));
+        }
+        if (!ifs) return false;
+        ifs.close();
+
+        if (!sidecar_map.open(sidecar) || sidecar_map.size() < end) {
+            sidecar_map.close();
+            return false;
+        }
+        for (Level & lv : levels) {
+            lv.data = reinterpret_cast<const double *>(sidecar_map.data() + lv.offset);
+        }
+        std::cerr << "Pyramid: Using " << levels.size() << " levels from " << sidecar << "\n";
+        return true;
+    }
+
+    void Pyramid::_build(const std::string & sidecar, const std::string & path, int64_t file_size, int64_t mtime,
+                         int64_t nints, int64_t nchans, int factor, const BinFunc & bin) {
+        std::cerr << "Pyramid: Building " << levels.size() << " levels (one pass over the data)...\n";
+
+        // finest level, from the data file
+        Level & base = levels[0];
+        {
+            Eigen::MatrixXd buf(base.n_f + 2, base.n_t + 2);
+            bin(buf, 0, base.n_t * base.fac_t, base.fac_t, 0, base.n_f * base.fac_f, base.fac_f);
+            base.mem = buf.block(1, 1, base.n_f, base.n_t);
+        }
+
+        // coarser levels, each from the previous one
+        for (size_t i = 1; i < levels.size(); ++i) {
+            const Level & prev = levels[i - 1];
+            Level & lv = levels[i];
+            int64_t rt = lv.fac_t / prev.fac_t, rf = lv.fac_f / prev.fac_f;
+            lv.mem = Eigen::MatrixXd::Zero(lv.n_f, lv.n_t);
+            for (int64_t t = 0; t < prev.n_t; ++t) {
+                for (int64_t f = 0; f < prev.n_f; ++f) {
+                    lv.mem(f / rf, t / rt) += prev.mem(f, t);
+                }
+            }
+        }
+
+        // write sidecar to a temporary file, then move it into place
+        int64_t offset = _pad8(_header_bytes(path, levels.size()));
+        for (Level & lv : levels) {
+            lv.offset = offset;
+            offset += lv.n_t * lv.n_f * int64_t(sizeof(double));
+        }
+
+        const std::string tmp_path = sidecar + ".tmp";
+        bool written;
+        {
+            std::ofstream ofs(tmp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+            ofs.write(PYRAMID_MAGIC, sizeof(PYRAMID_MAGIC));
+            _write_i64(ofs, file_size);
+            _write_i64(ofs, mtime);
+            _write_i64(ofs, nints);
+            _write_i64(ofs, nchans);
+            _write_i64(ofs, factor);
+            _write_i64(ofs, static_cast<int64_t>(levels.size()));
+            _write_i64(ofs, static_cast<int64_t>(path.size()));
+            std::string padded_path = path;
+            padded_path.resize(_pad8(path.size()), '\0');
+            ofs.write(padded_path.data(), padded_path.size());
+            for (const Level & lv : levels) {
+                _write_i64(ofs, lv.fac_t);
+                _write_i64(ofs, lv.fac_f);
+                _write_i64(ofs, lv.n_t);
+                _write_i64(ofs, lv.n_f);
+                _write_i64(ofs, lv.offset);
+            }
+            for (const Level & lv : levels) {
+                std::string pad(lv.offset - static_cast<int64_t>(ofs.tellp()), '\0');
+                ofs.write(pad.data(), pad.size());
+                ofs.write((const char *)lv.mem.data(), lv.n_t * lv.n_f * sizeof(double));
+            }
+            written = static_cast<bool>(ofs);
+        }
+        std::remove(sidecar.c_str());
+        written = written && !std::rename(tmp_path.c_str(), sidecar.c_str());
+
+        if (written && sidecar_map.open(sidecar)) {
+            for (Level & lv : levels) {
+                lv.data = reinterpret_cast<const double *>(sidecar_map.data() + lv.offset);
+                lv.mem.resize(0, 0);
+            }
+            std::cerr << "Pyramid: Saved to " << sidecar << "\n";
+        }
+        else {
+            // keep the levels in memory for this session
+            std::remove(tmp_path.c_str());
+            for (Level & lv : levels) {
+                lv.data = lv.mem.data();
+            }
+            std::cerr << "Pyramid: WARNING: Could not write " << sidecar << ", keeping pyramid in memory\n";
+        }
+    }
+}
@@ -1,18 +1,404 @@
 #include "stdafx.h"
 #include "renderer.hpp"
+#include "threadpool.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define WATPLOT_AVX2_KERNEL
+    #include <immintrin.h>
+#endif
+
+namespace {
+    using watplot::Renderer;
+    using watplot::ViewTable;
+
+    /* Row kernel: computes the box-filtered power of plot pixels [x_lo, x_hi) of a row, whose time extent is span 0
+       of 'row' (a single span) and whose frequency extents are given by 'cols'; arithmetic matches
+       Renderer::compute_pixel exactly. Along a row, the view columns used are fixed:
+       view_cols holds the columns at row.in_lo, row.in_hi, row.out_lo, row.out_hi */
+    typedef void(*RowKernel)(const ViewTable::Column * view_cols, const Renderer::PixelSpans & row,
+                             const Renderer::PixelSpans & cols, int x_lo, int x_hi, float * out);
+
+    /* view lookup, for a given storage type */
+    template<ViewTable::Storage STORAGE>
+    inline double _lookup(const ViewTable::Column & col, int r) {
+        return STORAGE == ViewTable::DOUBLE ? col.data[r] :
+            col.offsets[r >> ViewTable::TILE_SHIFT] + col.boundary[r] + col.local[r];
+    }
+
+    template<ViewTable::Storage STORAGE>
+    void _row_kernel_scalar(const ViewTable::Column * view_cols, const Renderer::PixelSpans & row,
+                            const Renderer::PixelSpans & cols, int x_lo, int x_hi, float * out) {
+        const ViewTable::Column & c_in_lo = view_cols[0], & c_in_hi = view_cols[1];
+        const ViewTable::Column & c_out_lo = view_cols[2], & c_out_hi = view_cols[3];
+        double row_wid = row.hi[0] - row.lo[0];
+        int row_in_wid = row.in_hi[0] - row.in_lo[0], row_out_wid = row.out_hi[0] - row.out_lo[0];
+
+        for (int x = x_lo; x < x_hi; ++x) {
+            double area = row_wid * (cols.hi[x] - cols.lo[x]);
+            if (area <= 0.0f) {
+                out[x] = 0.0f;
+                continue;
+            }
+            double area_i = row_in_wid * (cols.in_hi[x] - cols.in_lo[x]);
+            double area_o = max(double(row_out_wid * (cols.out_hi[x] - cols.out_lo[x])), area);
+
+            double ans_o = _lookup<STORAGE>(c_out_hi, cols.out_hi[x]) - _lookup<STORAGE>(c_out_hi, cols.out_lo[x]) -
+                           _lookup<STORAGE>(c_out_lo, cols.out_hi[x]) + _lookup<STORAGE>(c_out_lo, cols.out_lo[x]);
+            ans_o /= area_o;
+            if (area_i <= 0) {
+                out[x] = static_cast<float>(ans_o);
+                continue;
+            }
+            double ans_i = _lookup<STORAGE>(c_in_hi, cols.in_hi[x]) - _lookup<STORAGE>(c_in_hi, cols.in_lo[x]) -
+                           _lookup<STORAGE>(c_in_lo, cols.in_hi[x]) + _lookup<STORAGE>(c_in_lo, cols.in_lo[x]);
+            ans_i /= area_i;
+
+            float fo = static_cast<float>((area - area_i) / area_o);
+            out[x] = static_cast<float>(fo * ans_o + (1. - fo) * ans_i);
+        }
+    }
+
+#ifdef WATPLOT_AVX2_KERNEL
+    /* view lookup of 4 rows at once, for a given storage type */
+    template<ViewTable::Storage STORAGE>
+    __attribute__((target("avx2")))
+    inline __m256d _lookup4(const ViewTable::Column & col, __m128i r) {
+        if (STORAGE == ViewTable::DOUBLE) return _mm256_i32gather_pd(col.data, r, 8);
+        __m256d offsets = _mm256_i32gather_pd(col.offsets, _mm_srli_epi32(r, ViewTable::TILE_SHIFT), 8);
+        __m256d res = _mm256_add_pd(offsets, _mm256_i32gather_pd(col.boundary, r, 8));
+        return _mm256_add_pd(res, _mm256_cvtps_pd(_mm_i32gather_ps(col.local, r, 4)));
+    }
+
+    /* AVX2 version of the row kernel, 4 pixels at a time (view lookups are gathers) */
+    template<ViewTable::Storage STORAGE>
+    __attribute__((target("avx2")))
+    void _row_kernel_avx2(const ViewTable::Column * view_cols, const Renderer::PixelSpans & row,
+                          const Renderer::PixelSpans & cols, int x_lo, int x_hi, float * out) {
+        const ViewTable::Column & c_in_lo = view_cols[0], & c_in_hi = view_cols[1];
+        const ViewTable::Column & c_out_lo = view_cols[2], & c_out_hi = view_cols[3];
+        const __m256d row_wid = _mm256_set1_pd(row.hi[0] - row.lo[0]);
+        const __m128i row_in_wid = _mm_set1_epi32(row.in_hi[0] - row.in_lo[0]);
+        const __m128i row_out_wid = _mm_set1_epi32(row.out_hi[0] - row.out_lo[0]);
+        const __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1.0);
+
+        int x = x_lo;
+        for (; x + 4 <= x_hi; x += 4) {
+            __m256d area = _mm256_mul_pd(row_wid,
+                _mm256_sub_pd(_mm256_loadu_pd(&cols.hi[x]), _mm256_loadu_pd(&cols.lo[x])));
+            __m256d empty = _mm256_cmp_pd(area, zero, _CMP_LE_OQ);
+            if (_mm256_movemask_pd(empty) == 0xF) {
+                _mm_storeu_ps(out + x, _mm_setzero_ps());
+                continue;
+            }
+            __m128i in_lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&cols.in_lo[x]));
+            __m128i in_hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&cols.in_hi[x]));
+            __m128i out_lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&cols.out_lo[x]));
+            __m128i out_hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&cols.out_hi[x]));
+
+            __m256d area_i = _mm256_cvtepi32_pd(_mm_mullo_epi32(row_in_wid, _mm_sub_epi32(in_hi, in_lo)));
+            __m256d area_o = _mm256_max_pd(
+                _mm256_cvtepi32_pd(_mm_mullo_epi32(row_out_wid, _mm_sub_epi32(out_hi, out_lo))), area);
+
+            __m256d ans_o = _mm256_sub_pd(_lookup4<STORAGE>(c_out_hi, out_hi), _lookup4<STORAGE>(c_out_hi, out_lo));
+            ans_o = _mm256_sub_pd(ans_o, _lookup4<STORAGE>(c_out_lo, out_hi));
+            ans_o = _mm256_add_pd(ans_o, _lookup4<STORAGE>(c_out_lo, out_lo));
+            ans_o = _mm256_div_pd(ans_o, area_o);
+
+            __m256d ans_i = _mm256_sub_pd(_lookup4<STORAGE>(c_in_hi, in_hi), _lookup4<STORAGE>(c_in_hi, in_lo));
+            ans_i = _mm256_sub_pd(ans_i, _lookup4<STORAGE>(c_in_lo, in_hi));
+            ans_i = _mm256_add_pd(ans_i, _lookup4<STORAGE>(c_in_lo, in_lo));
+            ans_i = _mm256_div_pd(ans_i, area_i);
+
+            // interpolation weight is rounded to float, as in compute_pixel
+            __m256d fo = _mm256_cvtps_pd(_mm256_cvtpd_ps(_mm256_div_pd(_mm256_sub_pd(area, area_i), area_o)));
+            __m256d res = _mm256_add_pd(_mm256_mul_pd(fo, ans_o), _mm256_mul_pd(_mm256_sub_pd(one, fo), ans_i));
+
+            // no inner area: outer average only; empty: zero
+            res = _mm256_blendv_pd(res, ans_o, _mm256_cmp_pd(area_i, zero, _CMP_LE_OQ));
+            res = _mm256_blendv_pd(res, zero, empty);
+            _mm_storeu_ps(out + x, _mm256_cvtpd_ps(res));
+        }
+
+        // remaining pixels
+        _row_kernel_scalar<STORAGE>(view_cols, row, cols, x, x_hi, out);
+    }
+#endif
+
+    /* pick the fastest row kernel supported by this CPU, for a storage type */
+    template<ViewTable::Storage STORAGE>
+    RowKernel _select_row_kernel() {
+#ifdef WATPLOT_AVX2_KERNEL
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return _row_kernel_avx2<STORAGE>;
+#endif
+        return _row_kernel_scalar<STORAGE>;
+    }
+
+    /* fraction of the extra view area to place before the render along an axis, given the direction of motion
+       (most of it goes ahead of the render) */
+    double _margin_before(double motion) {
+        return motion > 0 ? 0.25 : (motion < 0 ? 0.75 : 0.5);
+    }
+}
 
 namespace watplot {
+    const double Renderer::MAX_BIN_PIXELS = 2.5;
+    const double Renderer::MAX_VIEW_EXPANSION = 3.0;
+    const int Renderer::ROW_BLOCK = 8;
+    const double Renderer::PAN_EPS = 1e-4;
+    const int Renderer::MAX_PREVIEW = 8;
+
+    Renderer::~Renderer() {
+        stop_loader();
+    }
+
     cv::Mat Renderer::render(int recompute_view)
     {
+        // (cancels the scheduled full-resolution render)
+        refine_pending = false;
+        refine_rows = 0;
+        refine_raw = cv::Mat();
+
+        // track direction of panning, for prefetching
+        if (render_rect.width == last_render_rect.width && render_rect.height == last_render_rect.height) {
+            cv::Point2d delta((render_rect.x - last_render_rect.x) / render_rect.width,
+                (render_rect.y - last_render_rect.y) / render_rect.height);
+            if (delta.x != 0.0 || delta.y != 0.0) motion = delta;
+        }
+        else {
+            motion = cv::Point2d(0.0, 0.0);
+        }
+        last_render_rect = render_rect;
+
         update_dxy();
+        compute_time = 0.0;
+        auto start_time = std::chrono::high_resolution_clock::now();
         cv::Mat res = _render(recompute_view);
+        if (recompute_view != 2) {
+            // (waiting for a view to load is not part of the usual cost of a render)
+            double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count();
+            frame_overhead = max(elapsed - compute_time, 0.0);
+        }
         return res;
     }
 
+    cv::Mat Renderer::render_interactive() {
+        // estimate the time to render at full resolution (only the exposed pixels, if panning by whole pixels)
+        update_dxy();
+        int64_t n = int64_t(plot_size.width) * plot_size.height;
+        int sy, sx;
+        if (_pan_shift(sy, sx)) n -= int64_t(plot_size.height - std::abs(sy)) * (plot_size.width - std::abs(sx));
+        int f = 1;
+        while (frame_budget > 0.0 && f < MAX_PREVIEW && frame_overhead + pixel_time * n / (f * f) > frame_budget) {
+            f *= 2;
+        }
+
+        preview = f;
+        cv::Mat res = render();
+        preview = 1;
+        refine_pending = f > 1;
+        last_interaction = std::chrono::high_resolution_clock::now();
+        return res;
+    }
+
+    bool Renderer::refine() {
+        if (!refine_pending) return false;
+        if (refine_rows == 0) {
+            // start once interaction has paused
+            double idle = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - last_interaction).count();
+            if (idle < frame_budget) return false;
+            update_dxy();
+            prepare_columns();
+            refine_raw = cv::Mat(plot_size, CV_32F);
+        }
+
+        // compute about frame_budget's worth of rows
+        int n_rows = pixel_time > 0.0 ? static_cast<int>(frame_budget / (pixel_time * plot_size.width)) : plot_size.height;
+        n_rows = min(max(n_rows, ROW_BLOCK), plot_size.height - refine_rows);
+        auto start_time = std::chrono::high_resolution_clock::now();
+        ThreadPool::global().parallel_for(refine_rows, refine_rows + n_rows, ROW_BLOCK, [&](int lo, int hi) {
+            for (int y = lo; y < hi; ++y) {
+                compute_row(y, refine_raw.ptr<float>(y));
+            }
+        });
+        _time_pixels(std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count(),
+                     int64_t(n_rows) * plot_size.width);
+        refine_rows += n_rows;
+        if (refine_rows < plot_size.height) return false;
+
+        // done: these become the last pixels, so that the render reuses all of them
+        last_raw = refine_raw;
+        last_raw_dx = dx;
+        last_raw_dy = dy;
+        last_raw_px = px;
+        last_raw_py = py;
+        render(0);
+        return true;
+    }
+
     cv::Mat Renderer::get_last_render() const {
         return last_render;
     }
 
+    bool Renderer::poll() {
+        {
+            std::lock_guard<std::mutex> lock(loader_mutex);
+            if (!next_ready) return false;
+        }
+        render_interactive();
+        return true;
+    }
+
+    void Renderer::update_view(int recompute_view) {
+        if (recompute_view == 2) {
+            _request_view(true);
+        }
+        else if (recompute_view == 1) {
+            if (_swap_view()) _view_swapped();
+            if (_view_stale()) _request_view(false);
+        }
+        update_dxy();
+    }
+
+    void Renderer::data_appended(const cv::Rect2d & new_data_rect) {
+        // follow the end of the data if the render reaches it (to within a sample)
+        double old_end = data_rect.x + data_rect.width, new_end = new_data_rect.x + new_data_rect.width;
+        bool follow = render_rect.x + render_rect.width >= old_end - sample_size.x;
+        data_rect = new_data_rect;
+        if (follow && new_end > old_end) {
+            render_rect.x += new_end - old_end;
+        }
+        render();
+    }
+
+    void Renderer::stop_loader() {
+        {
+            std::lock_guard<std::mutex> lock(loader_mutex);
+            loader_stop = true;
+            abort_speculative = true;
+        }
+        loader_cv.notify_all();
+        if (loader.joinable()) loader.join();
+    }
+
+    bool Renderer::_adequate(const cv::Rect2d & rect, double bin_x, double bin_y) const {
+        cv::Rect2d need = render_rect & data_rect;
+        if (need.width <= 0.0 || need.height <= 0.0) return true;
+
+        // coverage (allowing for rounding error)
+        double eps_x = rect.width * 1e-9, eps_y = rect.height * 1e-9;
+        if (need.x < rect.x - eps_x || need.x + need.width > rect.x + rect.width + eps_x ||
+            need.y < rect.y - eps_y || need.y + need.height > rect.y + rect.height + eps_y) {
+            return false;
+        }
+
+        // resolution: a bin may not span too many pixels, unless it is already a single sample
+        double rdx = render_rect.width / plot_size.height;
+        double rdy = render_rect.height / plot_size.width;
+        if (bin_x > rdx * MAX_BIN_PIXELS && bin_x > sample_size.x * 1.5) return false;
+        if (bin_y > rdy * MAX_BIN_PIXELS && bin_y > sample_size.y * 1.5) return false;
+        return true;
+    }
+
+    bool Renderer::_view_stale() const {
+        if (view.cols() <= 2 || view.rows() <= 2) return true;
+        return !_adequate(view_rect, view_rect.width / (view.cols() - 2), view_rect.height / (view.rows() - 2));
+    }
+
+    void Renderer::_request_view(bool wait) {
+        // make the view larger than the render to leave room for panning, with most of the extra area
+        // ahead of the render if it is moving
+        double ex_x = min(max(view_scale_x, 1.0), MAX_VIEW_EXPANSION);
+        double ex_y = min(max(view_scale_y, 1.0), MAX_VIEW_EXPANSION);
+        cv::Rect2d rect;
+        rect.width = render_rect.width * ex_x;
+        rect.height = render_rect.height * ex_y;
+        rect.x = render_rect.x - (rect.width - render_rect.width) * _margin_before(motion.x);
+        rect.y = render_rect.y - (rect.height - render_rect.height) * _margin_before(motion.y);
+        int max_wid = static_cast<int>(plot_size.height * view_scale_x);
+        int max_hi = static_cast<int>(plot_size.width * view_scale_y);
+
+        std::unique_lock<std::mutex> lock(loader_mutex);
+        if (!wait) {
+            // already loaded (still stale, e.g. the data ends here), or a suitable view is on the way
+            if (rect == view_request_rect) return;
+            if ((request_pending || loading) &&
+                _adequate(request_rect, request_rect.width / request_wid, request_rect.height / request_hi)) {
+                return;
+            }
+        }
+        request_rect = rect;
+        request_wid = max_wid;
+        request_hi = max_hi;
+        request_motion = motion;
+        request_pending = true;
+        abort_speculative = true;
+        if (!loader.joinable()) {
+            loader_stop = false;
+            loader = std::thread(&Renderer::_loader_loop, this);
+        }
+        loader_cv.notify_all();
+
+        if (wait) {
+            loader_cv.wait(lock, [this] { return !request_pending && !loading; });
+            lock.unlock();
+            if (_swap_view()) _view_swapped();
+        }
+    }
+
+    bool Renderer::_swap_view() {
+        std::lock_guard<std::mutex> lock(loader_mutex);
+        if (!next_ready) return false;
+        view.swap(next_view);
+        view_rect = next_view_rect;
+        invalidate_pixels();
+        view_request_rect = next_request_rect;
+        next_ready = false;
+        // free the stale view
+        next_view.clear();
+        return true;
+    }
+
+    void Renderer::_loader_loop() {
+        std::unique_lock<std::mutex> lock(loader_mutex);
+        while (true) {
+            loader_cv.wait(lock, [this] { return loader_stop || request_pending; });
+            if (loader_stop) break;
+            cv::Rect2d rect = request_rect;
+            cv::Point2d dir = request_motion;
+            int max_wid = request_wid, max_hi = request_hi;
+            request_pending = false;
+            loading = true;
+            lock.unlock();
+
+            ViewTable buf(view_storage);
+            cv::Rect2d buf_rect = _load_view(rect, buf, max_wid, max_hi);
+
+            lock.lock();
+            next_view.swap(buf);
+            next_view_rect = buf_rect;
+            next_request_rect = rect;
+            next_ready = true;
+            loading = false;
+            loader_cv.notify_all();
+
+            // speculatively load the next view along the direction of motion, to warm the cache;
+            // a new request (or stop) aborts it at the next tile column, so it never delays a real load
+            if (!request_pending && !loader_stop && (dir.x != 0.0 || dir.y != 0.0)) {
+                cv::Rect2d ahead = rect;
+                ahead.x += ((dir.x > 0.0) - (dir.x < 0.0)) * rect.width / 2;
+                ahead.y += ((dir.y > 0.0) - (dir.y < 0.0)) * rect.height / 2;
+                abort_speculative = false;
+                lock.unlock();
+                tiles.set_abort(&abort_speculative);
+                ViewTable scratch(view_storage);
+                _load_view(ahead, scratch, max_wid, max_hi);
+                tiles.set_abort(nullptr);
+                lock.lock();
+            }
+        }
+    }
+
     cv::Point2d Renderer::plot_to_time_freq(cv::Point2d point) const {
         double dx = render_rect.width / plot_size.height;
         double dy = render_rect.height / plot_size.width;
@@ -75,5 +461,246 @@ namespace watplot {
         float fo = (area - area_i) / area_o;
         return fo * ans_o + (1. - fo) * ans_i;
     }
-}
 
+    void Renderer::prepare_columns() {
+        col_spans.resize(plot_size.width);
+        double max_val = view.rows() - 1.f;
+        for (int x = 0; x < plot_size.width; ++x) {
+            // same projections as compute_pixel
+            col_spans.set(x, plot_to_view(cv::Point2i(x, 1)).y, plot_to_view(cv::Point2i(x + 1, 0)).y, max_val);
+        }
+    }
+
+    void Renderer::compute_row(int y, float * out, int x_lo, int x_hi) const {
+        if (x_hi < 0) x_hi = plot_size.width;
+        if (x_lo >= x_hi) return;
+        if (static_cast<int>(col_spans.lo.size()) < plot_size.width) {
+            std::fill(out + x_lo, out + x_hi, 0.0f);
+            return;
+        }
+        PixelSpans row;
+        row.resize(1);
+        row.set(0, plot_to_view(cv::Point2i(0, y + 1)).x, plot_to_view(cv::Point2i(1, y)).x, view.cols() - 1.f);
+        _compute_spans(row, col_spans, x_lo, x_hi, out);
+    }
+
+    void Renderer::compute_spectrum(float * out) const {
+        if (static_cast<int>(col_spans.lo.size()) < plot_size.width) {
+            std::fill(out, out + plot_size.width, 0.0f);
+            return;
+        }
+        // a row as tall as the plot
+        PixelSpans row;
+        row.resize(1);
+        row.set(0, plot_to_view(cv::Point2i(0, plot_size.height)).x, plot_to_view(cv::Point2i(1, 0)).x,
+                view.cols() - 1.f);
+        _compute_spans(row, col_spans, 0, plot_size.width, out);
+    }
+
+    void Renderer::compute_time_series(float * out) const {
+        // a column as wide as the plot
+        PixelSpans band;
+        band.resize(1);
+        band.set(0, plot_to_view(cv::Point2i(0, 1)).y, plot_to_view(cv::Point2i(plot_size.width, 0)).y,
+                 view.rows() - 1.f);
+        ThreadPool::global().parallel_for(0, plot_size.height, ROW_BLOCK, [&](int lo, int hi) {
+            PixelSpans row;
+            row.resize(1);
+            for (int y = lo; y < hi; ++y) {
+                row.set(0, plot_to_view(cv::Point2i(0, y + 1)).x, plot_to_view(cv::Point2i(1, y)).x, view.cols() - 1.f);
+                _compute_spans(row, band, 0, 1, out + y);
+            }
+        });
+    }
+
+    void Renderer::_compute_spans(const PixelSpans & row, const PixelSpans & cols, int x_lo, int x_hi,
+                                  float * out) const {
+        static const RowKernel kernels[] = {
+            _select_row_kernel<ViewTable::DOUBLE>(), _select_row_kernel<ViewTable::FLOAT>()
+        };
+        if (row.hi[0] <= row.lo[0]) {
+            std::fill(out + x_lo, out + x_hi, 0.0f);
+            return;
+        }
+
+        // the view columns used by this row
+        std::vector<double> offsets_buf(4 * view.tile_rows());
+        ViewTable::Column view_cols[4];
+        const int col_idx[4] = { row.in_lo[0], row.in_hi[0], row.out_lo[0], row.out_hi[0] };
+        for (int i = 0; i < 4; ++i) {
+            view_cols[i] = view.column(col_idx[i], offsets_buf.data() + i * view.tile_rows());
+        }
+        kernels[view.storage()](view_cols, row, cols, x_lo, x_hi, out);
+    }
+
+    void Renderer::compute_pixels(cv::Mat & raw, util::LogHistogram * hist) {
+        auto start_time = std::chrono::high_resolution_clock::now();
+        // (a new buffer: the last one is kept)
+        raw = cv::Mat(plot_size, CV_32F);
+        std::mutex hist_mtx;
+
+        if (preview > 1) {
+            // the same view, with the pixels of each box of f x f pixels (xp, yp) ~ [f xp, f xp + f) x [f yp, f yp + f)
+            // computed as one pixel of a smaller plot
+            int f = preview;
+            cv::Size full_size = plot_size;
+            plot_size = cv::Size((full_size.width + f - 1) / f, (full_size.height + f - 1) / f);
+            px = (px + full_size.height - f * plot_size.height + f - 1) / f;
+            py /= f;
+            dx *= f;
+            dy *= f;
+            cv::Mat small(plot_size, CV_32F);
+            prepare_columns();
+            ThreadPool::global().parallel_for(0, small.rows, ROW_BLOCK, [&](int lo, int hi) {
+                for (int y = lo; y < hi; ++y) {
+                    compute_row(y, small.ptr<float>(y));
+                }
+                if (hist) {
+                    util::LogHistogram block_hist;
+                    for (int y = lo; y < hi; ++y) {
+                        block_hist.add(small.ptr<float>(y), small.cols);
+                    }
+                    std::lock_guard<std::mutex> lock(hist_mtx);
+                    hist->merge(block_hist);
+                }
+            });
+            plot_size = full_size;
+            update_dxy();
+            prepare_columns();
+
+            ThreadPool::global().parallel_for(0, raw.rows, ROW_BLOCK, [&](int lo, int hi) {
+                for (int y = lo; y < hi; ++y) {
+                    const float * in = small.ptr<float>(y / f);
+                    float * out = raw.ptr<float>(y);
+                    for (int x = 0; x < raw.cols; ++x) out[x] = in[x / f];
+                }
+            });
+            double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count();
+            compute_time += elapsed;
+            _time_pixels(elapsed, int64_t(small.rows) * small.cols);
+            return;
+        }
+
+        int sy, sx;
+        bool reuse = _pan_shift(sy, sx);
+        if (reuse) {
+            // snap the projection to the pan, so that the exposed pixels line up exactly with the reused ones
+            // (a pixel's value can depend on rounding where its edge meets a view bin's)
+            px = last_raw_px + sy;
+            py = last_raw_py + sx;
+        }
+        else {
+            sy = sx = 0;
+        }
+        prepare_columns();
+        // rows and columns available from the last pixels
+        int y_lo = max(sy, 0), y_hi = reuse ? min(plot_size.height + sy, plot_size.height) : 0;
+        int x_lo = max(-sx, 0), x_hi = min(plot_size.width - sx, plot_size.width);
+
+        // compute pixels in blocks of consecutive rows (neighbouring view columns); auto-levels
+        // histogram the pixels of each block as they are computed
+        ThreadPool::global().parallel_for(0, plot_size.height, ROW_BLOCK, [&](int lo, int hi) {
+            for (int y = lo; y < hi; ++y) {
+                float * out = raw.ptr<float>(y);
+                if (y >= y_lo && y < y_hi) {
+                    memcpy(out + x_lo, last_raw.ptr<float>(y - sy) + x_lo + sx, (x_hi - x_lo) * sizeof(float));
+                    compute_row(y, out, 0, x_lo);
+                    compute_row(y, out, x_hi, plot_size.width);
+                }
+                else {
+                    compute_row(y, out);
+                }
+            }
+            if (hist) {
+                util::LogHistogram block_hist;
+                for (int y = lo; y < hi; ++y) {
+                    block_hist.add(raw.ptr<float>(y), plot_size.width);
+                }
+                std::lock_guard<std::mutex> lock(hist_mtx);
+                hist->merge(block_hist);
+            }
+        });
+
+        last_raw = raw;
+        last_raw_dx = dx;
+        last_raw_dy = dy;
+        last_raw_px = px;
+        last_raw_py = py;
+
+        double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count();
+        compute_time += elapsed;
+        _time_pixels(elapsed, int64_t(plot_size.width) * plot_size.height - int64_t(y_hi - y_lo) * (x_hi - x_lo));
+    }
+
+    bool Renderer::_pan_shift(int & sy, int & sx) const {
+        if (last_raw.empty() || last_raw.size() != plot_size || dx != last_raw_dx || dy != last_raw_dy) return false;
+        double shift_y = std::round(px - last_raw_px), shift_x = std::round(py - last_raw_py);
+        if (std::fabs(px - last_raw_px - shift_y) >= PAN_EPS || std::fabs(py - last_raw_py - shift_x) >= PAN_EPS ||
+            std::fabs(shift_y) >= plot_size.height || std::fabs(shift_x) >= plot_size.width) {
+            return false;
+        }
+        sy = static_cast<int>(shift_y);
+        sx = static_cast<int>(shift_x);
+        return true;
+    }
+
+    void Renderer::_time_pixels(double seconds, int64_t n) {
+        // (too few pixels to time reliably)
+        static const int64_t MIN_TIMED_PIXELS = 1 << 12;
+        if (n < MIN_TIMED_PIXELS) return;
+        double t = seconds / n;
+        pixel_time = pixel_time > 0.0 ? 0.5 * (pixel_time + t) : t;
+    }
+
+    void Renderer::invalidate_pixels() {
+        last_raw = cv::Mat();
+        refine_rows = 0;
+    }
+
+    void Renderer::reset_levels() {
+        color_scale = NAN;
+    }
+
+    bool Renderer::need_levels() const {
+        return track_levels || std::isnan(color_scale);
+    }
+
+    void Renderer::set_levels(const util::LogHistogram & hist) {
+        static const float COLOR_FACT = 1.0, MIN_CUTOFF_LOG = 0.1;
+        if (hist.size() == 0) return;
+        float min_val = hist.percentile(levels_low), max_val = hist.percentile(levels_high);
+        if (min_val != 0.0 || max_val != 0.0) {
+            float min_scaled = log10(max(((1.f - MIN_CUTOFF_LOG) * min_val + MIN_CUTOFF_LOG * max_val), 1e-4));
+            log_color_scale = 255.f / (log10(max_val) - min_scaled);
+            log_color_offset = -min_scaled;
+            color_scale = 255.f / (max_val * COLOR_FACT - min_val / COLOR_FACT);
+            color_offset = -min_val / COLOR_FACT;
+        }
+    }
+
+    void Renderer::PixelSpans::resize(size_t n) {
+        lo.resize(n);
+        hi.resize(n);
+        in_lo.resize(n);
+        in_hi.resize(n);
+        out_lo.resize(n);
+        out_hi.resize(n);
+    }
+
+    void Renderer::PixelSpans::set(size_t i, double lo_val, double hi_val, double max_val) {
+        lo_val = max(lo_val, 0.f);
+        hi_val = min(hi_val, max_val);
+        if (hi_val <= 0.f || lo_val >= max_val) {
+            // outside of the view: zero area, indices kept valid
+            lo[i] = hi[i] = 0.0;
+            in_lo[i] = in_hi[i] = out_lo[i] = out_hi[i] = 0;
+            return;
+        }
+        lo[i] = lo_val;
+        hi[i] = hi_val;
+        in_lo[i] = int(ceil(lo_val));
+        in_hi[i] = int(hi_val);
+        out_lo[i] = int(lo_val);
+        out_hi[i] = int(ceil(hi_val));
+    }
+}
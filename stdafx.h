@@ -18,6 +18,9 @@
 #include <cctype>
 #include <thread>
 #include <future>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <iterator>
 #include <climits>
 #include <cfloat>
@@ -27,6 +30,8 @@
     #include <windows.h>
 #else
     #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/mman.h>
 #endif
 #include <sys/types.h>
 #include <sys/stat.h>
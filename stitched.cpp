@@ -0,0 +1,261 @@
+#include "stdafx.h"
+#include "stitched.hpp"
+#include "filterbank.hpp"
+#include "hdf5.hpp"
+#include "threadpool.hpp"
+
+namespace {
+    /* helper for opening one member data file of the given format */
+    template<class T>
+    watplot::Stitched::Member _open_member(const std::string & path) {
+        std::shared_ptr<T> file = std::make_shared<T>(path);
+        watplot::Stitched::Member m;
+        m.path = path;
+        m.header = file->header;
+        m.nints = file->nints;
+        m.file_size_bytes = file->file_size_bytes;
+        m.data_size_bytes = file->data_size_bytes;
+        m.offset = m.length = 0;
+        m.bin = [file](Eigen::MatrixXd & out, int64_t t_lo, int64_t t_hi, int64_t t_step,
+                       int64_t f_lo, int64_t f_hi, int64_t f_step) {
+            file->bin(out, t_lo, t_hi, t_step, f_lo, f_hi, f_step);
+        };
+        m.select_ifs = [file](const watplot::IFSelection & sel) { file->select_ifs(sel); };
+        m.file = file;
+        return m;
+    }
+
+    /* a range of samples [lo, hi) along the concatenated axis, relative to the member's first sample,
+     * binned with the given step into output bins starting at 'bin' */
+    struct Part {
+        size_t member;
+        int64_t lo, hi, step, bin;
+    };
+}
+
+namespace watplot {
+    const std::string Stitched::FILE_FORMAT_NAME = "Stitched data files";
+
+    Stitched::Stitched(const std::vector<std::string> & paths) {
+        if (paths.empty()) {
+            std::cerr << "Fatal error: No data files to stitch\n";
+            std::exit(1);
+        }
+        file_size_bytes = data_size_bytes = 0;
+        for (const std::string & path : paths) {
+            std::string ext = path.substr(path.find_last_of(".") + 1);
+            if (ext == "fil") {
+                members.push_back(_open_member<Filterbank>(path));
+            }
+            else if (ext == "h5" || ext == "hdf5") {
+                members.push_back(_open_member<HDF5>(path));
+            }
+            else {
+                std::cerr << "Error: Unrecognized extension: \"" << ext << "\". Only .h5, .hdf5, .fil supported.\n";
+                std::exit(5);
+            }
+            file_size_bytes += members.back().file_size_bytes;
+            data_size_bytes += members.back().data_size_bytes;
+        }
+
+        // concatenate in time if all members have the same channels; otherwise the members are sub-bands,
+        // which must have the same sampling
+        const Header first = members.front().header;
+        bool same_chans = true;
+        for (const Member & m : members) {
+            same_chans = same_chans && m.header.nchans == first.nchans &&
+                fabs(m.header.fch1 - first.fch1) <= fabs(first.foff) * 1e-3;
+        }
+        along = same_chans ? TIME : FREQUENCY;
+        for (const Member & m : members) {
+            const char * mismatch = nullptr;
+            if (fabs(m.header.foff - first.foff) > fabs(first.foff) * 1e-6) mismatch = "channel bandwidth (foff)";
+            else if (max(m.header.nifs, 1) != max(first.nifs, 1)) mismatch = "number of IFs (nifs)";
+            else if (fabs(m.header.tsamp - first.tsamp) > fabs(first.tsamp) * 1e-6) mismatch = "sample time (tsamp)";
+            // (tstart is in MJD, tsamp in seconds)
+            else if (along == FREQUENCY && fabs(m.header.tstart - first.tstart) * 86400.0 > fabs(first.tsamp) * 0.5) {
+                mismatch = "start time (tstart)";
+            }
+            if (mismatch) {
+                std::cerr << "Fatal error: Cannot stitch " << m.path << " with " << members.front().path <<
+                    ": different " << mismatch << "\n";
+                std::exit(7);
+            }
+        }
+
+        // order members along the file, e.g. by decreasing start time if time is reversed
+        double sign = along == TIME ? (first.tsamp < 0 ? -1.0 : 1.0) : (first.foff < 0 ? -1.0 : 1.0);
+        Along by = along;
+        std::stable_sort(members.begin(), members.end(), [by, sign](const Member & a, const Member & b) {
+            return by == TIME ? a.header.tstart * sign < b.header.tstart * sign :
+                                a.header.fch1 * sign < b.header.fch1 * sign;
+        });
+
+        // index of offsets along the concatenated axis. Scans are placed at their start time, and sub-bands at their
+        // first channel, so that samples missing between scans (e.g. the gaps of an ON/OFF cadence) and channels
+        // missing between sub-bands (e.g. from a missing compute node) are shown as 0 and the axes stay correct
+        int64_t offset = 0;
+        nints = 0;
+        for (size_t i = 0; i < members.size(); ++i) {
+            Member & m = members[i];
+            if (along == TIME) {
+                // (tstart is in MJD, tsamp in seconds)
+                m.offset = llround((m.header.tstart - members.front().header.tstart) * 86400.0 / first.tsamp);
+                m.length = m.nints;
+                if (m.offset < offset) {
+                    if (offset - m.offset > 1) {
+                        std::cerr << "Stitched: WARNING: " << m.path << " overlaps " << members[i - 1].path <<
+                            " by " << (offset - m.offset) * fabs(first.tsamp) << " s (placed after it)\n";
+                    }
+                    m.offset = offset;
+                }
+                else if (m.offset > offset) {
+                    std::cerr << "Stitched: " << (m.offset - offset) * fabs(first.tsamp) << " s gap before " <<
+                        m.path << " (shown as 0)\n";
+                }
+            }
+            else {
+                double chan = (m.header.fch1 - members.front().header.fch1) / first.foff;
+                m.offset = llround(chan);
+                m.length = m.header.nchans;
+                if (fabs(chan - m.offset) > 1e-3) {
+                    std::cerr << "Fatal error: Cannot stitch " << m.path << ": its channels are not aligned with " <<
+                        members.front().path << "\n";
+                    std::exit(7);
+                }
+                if (m.offset < offset) {
+                    std::cerr << "Fatal error: Cannot stitch " << m.path << ": its channels overlap " <<
+                        members[i - 1].path << "\n";
+                    std::exit(7);
+                }
+                if (m.offset > offset) {
+                    std::cerr << "Stitched: WARNING: " << m.offset - offset << " channels missing before " <<
+                        m.path << " (shown as 0)\n";
+                }
+                if (m.nints != members.front().nints) {
+                    std::cerr << "Stitched: WARNING: " << m.path << " has " << m.nints << " timestamps, " <<
+                        members.front().path << " has " << members.front().nints <<
+                        " (missing samples are shown as 0)\n";
+                }
+            }
+            offset = m.offset + m.length;
+            nints = along == TIME ? offset : max(nints, m.nints);
+        }
+
+        header = members.front().header;
+        if (along == FREQUENCY) header.nchans = static_cast<int>(offset);
+        file_path = members.front().path;
+        // members have their own overview pyramids
+        pyramid_factor = 0;
+        _init_axes();
+
+        std::cerr << *this;
+        std::cerr << "Stitched: " << members.size() << " files concatenated in " <<
+            (along == TIME ? "time" : "frequency") << "\n";
+        for (const Member & m : members) {
+            std::cerr << "Stitched: [" << m.offset << ", " << m.offset + m.length << ") " << m.path;
+            if (along == TIME) std::cerr << " (at " << timestamps.position(m.offset) - timestamps.position(0) << " s)";
+            std::cerr << "\n";
+        }
+    }
+
+    std::string Stitched::data_id() const {
+        std::string id = along == TIME ? "time" : "frequency";
+        for (const Member & m : members) id += "|" + _file_id(m.path);
+        return id + ifs.suffix();
+    }
+
+    void Stitched::_select_ifs() {
+        if (along == FREQUENCY && ifs.side_by_side && ifs.count() > 1) {
+            std::cerr << "Error: IFs cannot be shown side by side for sub-bands stitched in frequency\n";
+            std::exit(8);
+        }
+        for (const Member & m : members) m.select_ifs(ifs);
+    }
+
+    Axis Stitched::_time_axis() const {
+        Axis axis(header.tstart, header.tsamp, nints);
+        if (along != TIME) return axis;
+        for (size_t i = 1; i < members.size(); ++i) {
+            const Member & m = members[i];
+            // (tstart is in MJD, tsamp in seconds: positions are the first scan's tstart plus seconds)
+            double start = header.tstart + (m.header.tstart - header.tstart) * 86400.0;
+            // the scan's offset is its start rounded to a sample, so it starts past the sample before it, unless it
+            // overlaps the previous scan (and was placed after it): it then continues the previous scan's segment,
+            // as do scans starting right after the previous one
+            bool in_order = (start - axis.position(m.offset - 1)) / header.tsamp > 1e-3;
+            if (in_order && fabs(start - axis.position(m.offset)) > fabs(header.tsamp) * 1e-3) {
+                axis.add_segment(m.offset, start);
+            }
+        }
+        return axis;
+    }
+
+    void Stitched::_view(const cv::Rect2d & rect, Eigen::MatrixXd & out, int64_t t_lo, int64_t t_hi, int64_t t_step,
+                                                                       int64_t f_lo, int64_t f_hi, int64_t f_step) const
+    {
+        int64_t out_hi = out.rows() - 2, out_wid = out.cols() - 2;
+        bool in_time = along == TIME;
+        int64_t lo = in_time ? t_lo : f_lo, hi = in_time ? t_hi : f_hi, step = in_time ? t_step : f_step;
+        int64_t n_bins = in_time ? out_wid : out_hi;
+        out.setZero();
+
+        // split the range into parts within each member; a bin shared by two members is split between them
+        // (the first member's part is cut off at its end when binned, the second's starts with a partial bin)
+        std::vector<Part> parts;
+        std::vector<size_t> member_parts;
+        auto it = std::upper_bound(members.begin(), members.end(), lo,
+            [](int64_t x, const Member & m) { return x < m.offset; });
+        if (it != members.begin()) --it;
+        for (; it != members.end() && it->offset < hi; ++it) {
+            int64_t a = max(lo, it->offset), b = min(hi, it->offset + it->length);
+            if (a >= b) continue;
+            size_t i = static_cast<size_t>(it - members.begin());
+            member_parts.push_back(parts.size());
+            int64_t bin = (a - lo) / step;
+            if ((a - lo) % step) {
+                int64_t bin_end = min(lo + (bin + 1) * step, b);
+                parts.push_back(Part{ i, a - it->offset, bin_end - it->offset, bin_end - a, bin });
+                a = bin_end;
+                ++bin;
+            }
+            if (a < b) {
+                int64_t end = lo + (b - lo + step - 1) / step * step;
+                parts.push_back(Part{ i, a - it->offset, end - it->offset, step, bin });
+            }
+        }
+        member_parts.push_back(parts.size());
+
+        // bin each member's parts, members in parallel
+        std::vector<Eigen::MatrixXd> results(parts.size());
+        int n_members = static_cast<int>(member_parts.size()) - 1;
+        ThreadPool::global().parallel_for(0, n_members, 1, [&](int m_lo, int m_hi) {
+            for (size_t p = member_parts[m_lo]; p < member_parts[m_hi]; ++p) {
+                const Part & part = parts[p];
+                Eigen::MatrixXd & res = results[p];
+                int64_t n = (part.hi - part.lo) / part.step;
+                if (in_time) {
+                    res.resize(out_hi + 2, n + 2);
+                    members[part.member].bin(res, part.lo, part.hi, part.step, f_lo, f_hi, f_step);
+                }
+                else {
+                    res.resize(n + 2, out_wid + 2);
+                    members[part.member].bin(res, t_lo, t_hi, t_step, part.lo, part.hi, part.step);
+                }
+            }
+        });
+
+        // add up
+        for (size_t p = 0; p < parts.size(); ++p) {
+            const Part & part = parts[p];
+            int64_t n = min((part.hi - part.lo) / part.step, n_bins - part.bin);
+            if (n <= 0) continue;
+            if (in_time) {
+                out.block(1, part.bin + 1, out_hi, n) += results[p].block(1, 1, out_hi, n);
+            }
+            else {
+                out.block(part.bin + 1, 1, n, out_wid) += results[p].block(1, 1, n, out_wid);
+            }
+        }
+    }
+}
@@ -0,0 +1,115 @@
+#include "stdafx.h"
+#include "threadpool.hpp"
+
+namespace watplot {
+    ThreadPool::ThreadPool(int num_threads) {
+        if (num_threads <= 0) num_threads = default_size();
+        for (int i = 0; i < num_threads; ++i) {
+            queues.emplace_back(new Queue());
+        }
+        for (int i = 0; i < num_threads - 1; ++i) {
+            workers.emplace_back(&ThreadPool::_worker, this, static_cast<size_t>(i));
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mtx);
+            stop = true;
+        }
+        sleep_cv.notify_all();
+        for (auto & thd : workers) thd.join();
+    }
+
+    void ThreadPool::parallel_for(int l, int r, int grain, const std::function<void(int, int)> & f) {
+        if (r <= l) return;
+        int n_threads = size();
+        if (grain <= 0) grain = (r - l - 1) / n_threads + 1;
+        int n_blocks = (r - l - 1) / grain + 1;
+        if (n_blocks == 1 || n_threads == 1) {
+            for (int lo = l; lo < r; lo += grain) f(lo, min(lo + grain, r));
+            return;
+        }
+
+        // deal out runs of consecutive blocks, one run per queue
+        Batch batch;
+        batch.remaining = n_blocks;
+        for (int q = 0; q < n_threads; ++q) {
+            int b_lo = static_cast<int>(int64_t(n_blocks) * q / n_threads);
+            int b_hi = static_cast<int>(int64_t(n_blocks) * (q + 1) / n_threads);
+            if (b_lo == b_hi) continue;
+            std::lock_guard<std::mutex> lock(queues[q]->mtx);
+            for (int b = b_lo; b < b_hi; ++b) {
+                int lo = l + b * grain;
+                queues[q]->tasks.push_back(Task{ &f, lo, min(lo + grain, r), &batch });
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleep_mtx);
+            pending += n_blocks;
+        }
+        sleep_cv.notify_all();
+
+        // help with this loop's blocks until there are none left to take, then wait for the blocks still running
+        // (never with other threads' loops, e.g. the loader's I/O-bound blocks must not stall the UI thread)
+        while (_run_one(queues.size() - 1, &batch)) {}
+        std::unique_lock<std::mutex> lock(batch.mtx);
+        batch.cv.wait(lock, [&batch] { return batch.remaining == 0; });
+    }
+
+    ThreadPool & ThreadPool::global() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    int ThreadPool::default_size() {
+        const char * env = std::getenv("WATPLOT_THREADS");
+        if (env != nullptr && std::atoi(env) > 0) return std::atoi(env);
+        return max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    }
+
+    bool ThreadPool::_run_one(size_t self, const Batch * only) {
+        Task task;
+        bool found = false;
+        auto mine = [only](const Task & t) { return only == nullptr || t.batch == only; };
+        for (size_t i = 0; i < queues.size() && !found; ++i) {
+            Queue & queue = *queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mtx);
+            std::deque<Task> & tasks = queue.tasks;
+            if (i == 0) {
+                auto it = std::find_if(tasks.begin(), tasks.end(), mine);
+                if (it == tasks.end()) continue;
+                task = *it;
+                tasks.erase(it);
+            }
+            else {
+                auto it = std::find_if(tasks.rbegin(), tasks.rend(), mine);
+                if (it == tasks.rend()) continue;
+                task = *it;
+                tasks.erase(std::next(it).base());
+            }
+            found = true;
+        }
+        if (!found) return false;
+        {
+            std::lock_guard<std::mutex> lock(sleep_mtx);
+            --pending;
+        }
+
+        (*task.f)(task.lo, task.hi);
+
+        Batch * batch = task.batch;
+        std::lock_guard<std::mutex> lock(batch->mtx);
+        if (--batch->remaining == 0) batch->cv.notify_all();
+        return true;
+    }
+
+    void ThreadPool::_worker(size_t self) {
+        while (true) {
+            if (_run_one(self)) continue;
+            std::unique_lock<std::mutex> lock(sleep_mtx);
+            sleep_cv.wait(lock, [this] { return stop || pending > 0; });
+            if (stop) break;
+        }
+    }
+}
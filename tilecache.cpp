@@ -0,0 +1,160 @@
+#include "stdafx.h"
+#include "tilecache.hpp"
+#include "threadpool.hpp"
+
+namespace watplot {
+    const int64_t TileCache::TILE_SIZE = 256;
+
+    void TileCache::assemble(Eigen::MatrixXd & out, int64_t t_lo, int64_t t_hi, int64_t t_step,
+                             int64_t f_lo, int64_t f_hi, int64_t f_step, const BinFunc & bin) {
+        if (aborted()) return;
+
+        // bin indices of requested region
+        int64_t bt_lo = t_lo / t_step, bt_hi = t_hi / t_step;
+        int64_t bf_lo = f_lo / f_step, bf_hi = f_hi / f_step;
+
+        // tile indices covering it
+        int64_t ti_lo = bt_lo / TILE_SIZE, ti_hi = (bt_hi + TILE_SIZE - 1) / TILE_SIZE;
+        int64_t fi_lo = bf_lo / TILE_SIZE, fi_hi = (bf_hi + TILE_SIZE - 1) / TILE_SIZE;
+
+        int64_t tile_bytes = TILE_SIZE * TILE_SIZE * sizeof(double);
+        auto insert = [&](const Key & key, const Eigen::MatrixXd & data) {
+            lru.push_front(key);
+            Entry & entry = tiles[key];
+            entry.data = data;
+            entry.lru_it = lru.begin();
+            bytes += tile_bytes;
+        };
+
+        // read tiles which are not resident from the on-disk store, if any (decoding in parallel)
+        int64_t n_stored = 0;
+        if (store.is_open()) {
+            std::vector<Key> missing;
+            for (int64_t ti = ti_lo; ti < ti_hi; ++ti) {
+                for (int64_t fi = fi_lo; fi < fi_hi; ++fi) {
+                    Key key{ t_step, f_step, ti, fi };
+                    if (!tiles.count(key)) missing.push_back(key);
+                }
+            }
+            std::vector<Eigen::MatrixXd> data(missing.size());
+            std::vector<char> found(missing.size(), 0);
+            ThreadPool::global().parallel_for(0, static_cast<int>(missing.size()), 1, [&](int lo, int hi) {
+                for (int i = lo; i < hi; ++i) {
+                    data[i].resize(TILE_SIZE, TILE_SIZE);
+                    const Key & key = missing[i];
+                    found[i] = store.load(key.t_step, key.f_step, key.ti, key.fi, data[i]);
+                }
+            });
+            for (size_t i = 0; i < missing.size(); ++i) {
+                if (found[i]) insert(missing[i], data[i]);
+            }
+            n_stored = std::count(found.begin(), found.end(), 1);
+        }
+
+        int64_t n_missing = 0;
+        std::vector<Key> binned;
+        Eigen::MatrixXd buf;
+        for (int64_t ti = ti_lo; ti < ti_hi; ++ti) {
+            if (aborted()) break;
+            // read each run of missing tiles in this tile column with a single call
+            for (int64_t fi = fi_lo; fi < fi_hi; ) {
+                if (tiles.count(Key{ t_step, f_step, ti, fi })) {
+                    ++fi;
+                    continue;
+                }
+                int64_t run_end = fi + 1;
+                while (run_end < fi_hi && !tiles.count(Key{ t_step, f_step, ti, run_end })) ++run_end;
+
+                buf.resize((run_end - fi) * TILE_SIZE + 2, TILE_SIZE + 2);
+                bin(buf, ti * TILE_SIZE * t_step, (ti + 1) * TILE_SIZE * t_step, t_step,
+                    fi * TILE_SIZE * f_step, run_end * TILE_SIZE * f_step, f_step);
+                for (int64_t i = fi; i < run_end; ++i) {
+                    Key key{ t_step, f_step, ti, i };
+                    insert(key, buf.block(1 + (i - fi) * TILE_SIZE, 1, TILE_SIZE, TILE_SIZE));
+                    binned.push_back(key);
+                }
+                n_missing += run_end - fi;
+                fi = run_end;
+            }
+        }
+        std::cerr << "TileCache: " << (ti_hi - ti_lo) * (fi_hi - fi_lo) - n_missing - n_stored << " tiles resident, " <<
+            n_stored << " read from disk, " << n_missing << " loaded\n";
+
+        // save newly binned tiles to the on-disk store (encoding in parallel)
+        if (store.is_open() && !binned.empty()) {
+            ThreadPool::global().parallel_for(0, static_cast<int>(binned.size()), 1, [&](int lo, int hi) {
+                for (int i = lo; i < hi; ++i) {
+                    const Key & key = binned[i];
+                    store.save(key.t_step, key.f_step, key.ti, key.fi, tiles.at(key).data);
+                }
+            });
+        }
+
+        if (aborted()) {
+            // some tiles are missing; the caller discards the output
+            _evict(binned.size());
+            return;
+        }
+
+        // copy the tiles into the output
+        int64_t out_hi = bf_hi - bf_lo;
+        out.setZero();
+        for (int64_t ti = ti_lo; ti < ti_hi; ++ti) {
+            for (int64_t fi = fi_lo; fi < fi_hi; ++fi) {
+                Key key{ t_step, f_step, ti, fi };
+                Entry & entry = tiles[key];
+                lru.splice(lru.begin(), lru, entry.lru_it);
+
+                // intersection of tile with requested region, in bin indices
+                int64_t t0 = max(ti * TILE_SIZE, bt_lo), t1 = min((ti + 1) * TILE_SIZE, bt_hi);
+                int64_t f0 = max(fi * TILE_SIZE, bf_lo), f1 = min((fi + 1) * TILE_SIZE, bf_hi);
+                for (int64_t t = t0; t < t1; ++t) {
+                    const double * src = entry.data.data() + (t - ti * TILE_SIZE) * TILE_SIZE + (f0 - fi * TILE_SIZE);
+                    double * dst = out.data() + (t - bt_lo + 1) * (out_hi + 2) + (f0 - bf_lo + 1);
+                    std::copy(src, src + (f1 - f0), dst);
+                }
+            }
+        }
+
+        _evict(static_cast<size_t>((ti_hi - ti_lo) * (fi_hi - fi_lo)));
+    }
+
+    void TileCache::clear() {
+        tiles.clear();
+        lru.clear();
+        bytes = 0;
+    }
+
+    bool TileCache::open_store(const std::string & dir, const std::string & data_id) {
+        return store.open(dir, data_id);
+    }
+
+    void TileCache::set_extent(int64_t n_t) {
+        if (extent >= 0 && n_t != extent) {
+            // the data no longer matches the identity the store was opened with
+            store.close();
+            int64_t valid_t = min(n_t, extent);
+            int64_t tile_bytes = TILE_SIZE * TILE_SIZE * sizeof(double);
+            for (auto it = lru.begin(); it != lru.end(); ) {
+                if ((it->ti + 1) * TILE_SIZE * it->t_step > valid_t) {
+                    tiles.erase(*it);
+                    it = lru.erase(it);
+                    bytes -= tile_bytes;
+                }
+                else {
+                    ++it;
+                }
+            }
+        }
+        extent = n_t;
+    }
+
+    void TileCache::_evict(size_t keep) {
+        int64_t tile_bytes = TILE_SIZE * TILE_SIZE * sizeof(double);
+        while (bytes > budget_bytes && lru.size() > keep) {
+            tiles.erase(lru.back());
+            lru.pop_back();
+            bytes -= tile_bytes;
+        }
+    }
+}
@@ -0,0 +1,169 @@
+#include "stdafx.h"
+#include "tilestore.hpp"
+
+namespace {
+    const char TILE_MAGIC[8] = { 'W', 'A', 'T', 'T', 'I', 'L', 'E', '1' };
+
+    /* longest run of repeated bytes encoded by one control byte */
+    const int64_t MAX_REPEAT = 130;
+
+    /* longest run of literal bytes encoded by one control byte */
+    const int64_t MAX_LITERAL = 128;
+
+    /* 64-bit FNV-1a hash, used to name tile files after the data they hold */
+    uint64_t _fnv1a(const std::string & s) {
+        uint64_t h = 14695981039346656037ULL;
+        for (char c : s) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    /* length of the run of bytes equal to in[i] starting at i (at most MAX_REPEAT) */
+    int64_t _run_length(const unsigned char * in, int64_t i, int64_t n) {
+        int64_t j = i + 1;
+        while (j < n && j - i < MAX_REPEAT && in[j] == in[i]) ++j;
+        return j - i;
+    }
+}
+
+namespace watplot {
+    const std::string TileStore::TILE_EXT = ".wtile";
+
+    bool TileStore::open(const std::string & dir, const std::string & data_id) {
+        close();
+        struct stat st;
+        if (stat(dir.c_str(), &st)) {
+#ifdef _WIN32
+            CreateDirectoryA(dir.c_str(), NULL);
+#else
+            mkdir(dir.c_str(), 0777);
+#endif
+        }
+        if (stat(dir.c_str(), &st) || (st.st_mode & S_IFMT) != S_IFDIR) {
+            std::cerr << "TileStore: WARNING: Cannot use " << dir << " for the tile cache\n";
+            return false;
+        }
+
+        std::ostringstream ss;
+        ss << std::hex << std::setw(16) << std::setfill('0') << _fnv1a(data_id);
+        prefix = dir + (dir.back() == '/' || dir.back() == '\\' ? "" : "/") + ss.str();
+        std::cerr << "TileStore: Using " << dir << " for the tile cache\n";
+        return true;
+    }
+
+    void TileStore::close() {
+        prefix.clear();
+    }
+
+    bool TileStore::load(int64_t t_step, int64_t f_step, int64_t ti, int64_t fi, Eigen::MatrixXd & tile) const {
+        std::ifstream ifs(_tile_path(t_step, f_step, ti, fi), std::ios::in | std::ios::binary | std::ios::ate);
+        if (!ifs) return false;
+        int64_t len = static_cast<int64_t>(ifs.tellg());
+        if (len < static_cast<int64_t>(sizeof(TILE_MAGIC))) return false;
+        std::string buf(len, '\0');
+        ifs.seekg(0);
+        ifs.read(&buf[0], len);
+        if (!ifs || memcmp(buf.data(), TILE_MAGIC, sizeof(TILE_MAGIC))) return false;
+        return decode(buf.data() + sizeof(TILE_MAGIC), len - sizeof(TILE_MAGIC), tile.data(), tile.size());
+    }
+
+    void TileStore::save(int64_t t_step, int64_t f_step, int64_t ti, int64_t fi, const Eigen::MatrixXd & tile) const {
+        std::string buf(TILE_MAGIC, sizeof(TILE_MAGIC));
+        encode(tile.data(), tile.size(), buf);
+
+        // write to a temporary file, then move it into place, so that other sessions never see a partial tile
+        const std::string path = _tile_path(t_step, f_step, ti, fi);
+        std::ostringstream tmp_path;
+        tmp_path << path << ".tmp" << std::this_thread::get_id();
+        bool written;
+        {
+            std::ofstream ofs(tmp_path.str(), std::ios::out | std::ios::binary | std::ios::trunc);
+            ofs.write(buf.data(), buf.size());
+            written = static_cast<bool>(ofs);
+        }
+        std::remove(path.c_str());
+        if (!written || std::rename(tmp_path.str().c_str(), path.c_str())) {
+            std::remove(tmp_path.str().c_str());
+        }
+    }
+
+    void TileStore::encode(const double * data, int64_t n, std::string & out) {
+        // XOR with the previous sample, then shuffle bytes into planes
+        std::vector<unsigned char> planes(n * sizeof(uint64_t));
+        uint64_t prev = 0;
+        for (int64_t i = 0; i < n; ++i) {
+            uint64_t x;
+            memcpy(&x, data + i, sizeof(x));
+            uint64_t d = x ^ prev;
+            prev = x;
+            for (size_t b = 0; b < sizeof(uint64_t); ++b) {
+                planes[b * n + i] = static_cast<unsigned char>(d >> (8 * b));
+            }
+        }
+
+        // run-length encode: control byte c < 128: c + 1 literal bytes follow;
+        // c >= 128: the next byte is repeated c - 125 times
+        const unsigned char * in = planes.data();
+        int64_t len = static_cast<int64_t>(planes.size());
+        int64_t i = 0;
+        while (i < len) {
+            int64_t run = _run_length(in, i, len);
+            if (run >= 3) {
+                out.push_back(static_cast<char>(run + 125));
+                out.push_back(static_cast<char>(in[i]));
+                i += run;
+                continue;
+            }
+            // literals, until the next run of 3 or more
+            int64_t j = i;
+            while (j < len && j - i < MAX_LITERAL && _run_length(in, j, len) < 3) ++j;
+            out.push_back(static_cast<char>(j - i - 1));
+            out.append(reinterpret_cast<const char *>(in + i), j - i);
+            i = j;
+        }
+    }
+
+    bool TileStore::decode(const char * in, int64_t len, double * data, int64_t n) {
+        int64_t n_bytes = n * sizeof(uint64_t);
+        std::vector<unsigned char> planes(n_bytes);
+        const unsigned char * src = reinterpret_cast<const unsigned char *>(in);
+        int64_t i = 0, o = 0;
+        while (i < len) {
+            int64_t c = src[i++];
+            if (c >= 128) {
+                int64_t run = c - 125;
+                if (i >= len || o + run > n_bytes) return false;
+                std::fill(planes.begin() + o, planes.begin() + o + run, src[i++]);
+                o += run;
+            }
+            else {
+                int64_t run = c + 1;
+                if (i + run > len || o + run > n_bytes) return false;
+                std::copy(src + i, src + i + run, planes.begin() + o);
+                i += run;
+                o += run;
+            }
+        }
+        if (o != n_bytes) return false;
+
+        // unshuffle, undo XOR
+        uint64_t prev = 0;
+        for (int64_t k = 0; k < n; ++k) {
+            uint64_t d = 0;
+            for (size_t b = 0; b < sizeof(uint64_t); ++b) {
+                d |= static_cast<uint64_t>(planes[b * n + k]) << (8 * b);
+            }
+            prev ^= d;
+            memcpy(data + k, &prev, sizeof(prev));
+        }
+        return true;
+    }
+
+    std::string TileStore::_tile_path(int64_t t_step, int64_t f_step, int64_t ti, int64_t fi) const {
+        std::ostringstream ss;
+        ss << prefix << "-" << t_step << "-" << f_step << "-" << ti << "-" << fi << TILE_EXT;
+        return ss.str();
+    }
+}
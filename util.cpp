@@ -1,5 +1,12 @@
 #include "stdafx.h"
 #include "util.hpp"
+#include "threadpool.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define WATPLOT_AVX2_KERNEL
+    #include <immintrin.h>
+#endif
+
 namespace watplot {
     namespace util {
         /* from SO */
@@ -162,40 +169,16 @@ namespace watplot {
 
         void par_for(std::function<void(int, int)> f, int l, int r, int num_threads)
         {
-            if (num_threads == -1) num_threads = std::thread::hardware_concurrency();;
-            std::vector<std::thread> mgr;
-            int step = (r - 1) / num_threads + 1;
-            for (int i = 0; i < r; i += step) {
-                mgr.emplace_back(f, i, min(i + step, r));
-            }
-            for (auto & thd : mgr) thd.join();
-
+            ThreadPool & pool = ThreadPool::global();
+            if (num_threads == -1) num_threads = pool.size();
+            pool.parallel_for(l, r, (r - l - 1) / max(num_threads, 1) + 1, f);
         }
-        void par_foreach(std::function<void(int)> f, int l, int r, std::mutex * mtx, int num_threads)
+
+        void par_foreach(std::function<void(int)> f, int l, int r)
         {
-            if (num_threads == -1) num_threads = std::thread::hardware_concurrency();;
-            std::vector<std::thread> mgr;
-            int cnt = l;
-
-            bool own_mtx = !mtx;
-            if (own_mtx) mtx = new std::mutex();
-            for (int i = 0; i < num_threads; ++i) {
-                mgr.emplace_back([&]() {
-                    while (true) {
-                        mtx->lock();
-                        if (cnt >= r) {
-                            mtx->unlock();
-                            break;
-                        }
-                        int j = cnt;
-                        ++cnt;
-                        mtx->unlock();
-                        f(j);
-                    }
-                });
-            }
-            for (auto & thd : mgr) thd.join();
-            if (own_mtx) delete mtx;
+            ThreadPool::global().parallel_for(l, r, 1, [&f](int lo, int hi) {
+                for (int i = lo; i < hi; ++i) f(i);
+            });
         }
 
         double min_max_k_partition(std::vector<std::pair<double, int> > & x, int k, int s, Eigen::ArrayXi * out)
@@ -523,50 +506,380 @@ namespace watplot {
             { 0.993248, 0.906157, 0.143936 }
         };
 
+        namespace {
+            /* number of color maps (ids 0...14) */
+            const int NUM_COLORMAPS = 15;
+
+            std::vector<ColorLUT> _build_color_luts() {
+                std::vector<ColorLUT> luts(NUM_COLORMAPS);
+                cv::Mat ramp(1, 256, CV_8U), ramp_color;
+                for (int i = 0; i < 256; ++i) ramp.at<uchar>(0, i) = static_cast<uchar>(i);
+                for (int id = 0; id < NUM_COLORMAPS; ++id) {
+                    ColorLUT & lut = luts[id];
+                    if (id < 13) cv::applyColorMap(ramp, ramp_color, id);
+                    for (int i = 0; i < 256; ++i) {
+                        if (id < 13) {
+                            const cv::Vec3b & c = ramp_color.at<cv::Vec3b>(0, i);
+                            for (int k = 0; k < 3; ++k) lut.bgr[i][k] = c[k];
+                        }
+                        else if (id == 13) {
+                            for (int k = 0; k < 3; ++k) lut.bgr[i][k] = static_cast<uint8_t>(VIRIDIS[i][2 - k] * 255);
+                        }
+                        else {
+                            for (int k = 0; k < 3; ++k) lut.bgr[i][k] = static_cast<uint8_t>(i);
+                        }
+                    }
+                }
+                return luts;
+            }
+        }
+
+        const ColorLUT & color_lut(int cmap_id) {
+            static const std::vector<ColorLUT> luts = _build_color_luts();
+            return luts[cmap_id >= 0 && cmap_id < NUM_COLORMAPS ? cmap_id : NUM_COLORMAPS - 1];
+        }
+
         void applyColorMap(const cv::Mat & gray, cv::Mat & color, bool reverse, int cmap_id)
         {
-            if (cmap_id < 13) {
-                cv::applyColorMap(gray, color, cmap_id);
+            const ColorLUT & lut = color_lut(cmap_id);
+            color.create(gray.rows, gray.cols, CV_8UC3);
+            for (int y = 0; y < gray.rows; ++y) {
+                const uchar * p = gray.ptr<uchar>(y);
+                uchar * c = color.ptr<uchar>(y);
+                for (int x = 0; x < gray.cols; ++x) {
+                    const uint8_t * bgr = lut.bgr[reverse ? 255 - p[x] : p[x]];
+                    c[3 * x] = bgr[0];
+                    c[3 * x + 1] = bgr[1];
+                    c[3 * x + 2] = bgr[2];
+                }
             }
-            else if (cmap_id == 14) {
-                cv::cvtColor(gray, color, cv::COLOR_GRAY2BGR);
+        }
+
+        void colorize(const float * in, uint8_t * out, int n, float offset, float scale, bool log_scale,
+                      const ColorLUT & lut) {
+            // a block at a time: the gray levels are computed with Eigen (vectorized, including the log),
+            // then saturated and looked up
+            const int BLOCK = 256;
+            static const float LOG10_E = 0.43429448190325182f;
+            Eigen::Array<float, Eigen::Dynamic, 1, 0, BLOCK, 1> level;
+            for (int lo = 0; lo < n; lo += BLOCK) {
+                int len = min(n - lo, BLOCK);
+                Eigen::Map<const Eigen::ArrayXf> x(in + lo, len);
+                if (log_scale) {
+                    level = (x.log() * LOG10_E + offset) * scale + 0.5f;
+                }
+                else {
+                    level = (x + offset) * scale + 0.5f;
+                }
+                uint8_t * o = out + 3 * lo;
+                for (int i = 0; i < len; ++i) {
+                    // (NAN is level 0)
+                    float v = level[i];
+                    const uint8_t * bgr = lut.bgr[v >= 1.f ? (v < 255.f ? static_cast<int>(v) : 255) : 0];
+                    o[3 * i] = bgr[0];
+                    o[3 * i + 1] = bgr[1];
+                    o[3 * i + 2] = bgr[2];
+                }
             }
-            else if (cmap_id == 13) {
-                color = cv::Mat(gray.cols, gray.rows, CV_8UC3);
-
-                static double lut_r[256] = { -1 };
-                static double lut_g[256];
-                static double lut_b[256];
-
-                if (lut_r[0] == -1) {
-                    for (int i = 0; i < 256; i++) {
-                        lut_r[i] = VIRIDIS[i][0] * 255;
-                        lut_g[i] = VIRIDIS[i][1] * 255;
-                        lut_b[i] = VIRIDIS[i][2] * 255;
+        }
+
+        namespace {
+            /* lookup tables for bytes of packed 1, 2, 4-bit samples (index 0, 1, 2):
+             * the samples in each byte, least significant bits first, and their sum */
+            struct PackedTables {
+                uint8_t sample[3][256][8];
+                uint8_t sum[3][256];
+
+                PackedTables() {
+                    for (int k = 0; k < 3; ++k) {
+                        int nbits = 1 << k, per_byte = 8 / nbits, mask = (1 << nbits) - 1;
+                        for (int b = 0; b < 256; ++b) {
+                            sum[k][b] = 0;
+                            for (int i = 0; i < per_byte; ++i) {
+                                sample[k][b][i] = static_cast<uint8_t>((b >> (i * nbits)) & mask);
+                                sum[k][b] += sample[k][b][i];
+                            }
+                        }
                     }
                 }
+            };
 
-                cv::Mat p = gray.reshape(0, 1).clone();
-                cv::Mat c = color.reshape(0, 1).clone();
-                if (reverse) {
-                    for (int i = 0; i < p.cols; i++) {
-                        c.at<cv::Vec3b>(0, i)[0] = (uchar)lut_b[255 - p.at<uchar>(0, i)];
-                        c.at<cv::Vec3b>(0, i)[1] = (uchar)lut_g[255 - p.at<uchar>(0, i)];
-                        c.at<cv::Vec3b>(0, i)[2] = (uchar)lut_r[255 - p.at<uchar>(0, i)];
-                    }
+            const PackedTables & _packed_tables() {
+                static const PackedTables tables;
+                return tables;
+            }
+
+            /* Packed sample kernels, for table index k (see PackedTables):
+               unpack adds the samples of n_bytes whole bytes, times scale, to out[0], out[1], ...;
+               sum returns the sum of the samples of n_bytes whole bytes */
+            typedef void(*UnpackKernel)(const uint8_t * bytes, int64_t n_bytes, int k, double * out, double scale);
+            typedef int64_t(*SumKernel)(const uint8_t * bytes, int64_t n_bytes, int k);
+
+            void _unpack_scalar(const uint8_t * bytes, int64_t n_bytes, int k, double * out, double scale) {
+                const uint8_t (*sample)[8] = _packed_tables().sample[k];
+                int per_byte = 8 >> k;
+                for (int64_t b = 0; b < n_bytes; ++b, out += per_byte) {
+                    const uint8_t * s = sample[bytes[b]];
+                    for (int j = 0; j < per_byte; ++j) out[j] += s[j] * scale;
+                }
+            }
+
+            int64_t _sum_scalar(const uint8_t * bytes, int64_t n_bytes, int k) {
+                const uint8_t * sum = _packed_tables().sum[k];
+                int64_t acc = 0;
+                for (int64_t b = 0; b < n_bytes; ++b) acc += sum[bytes[b]];
+                return acc;
+            }
+
+#ifdef WATPLOT_AVX2_KERNEL
+            /* samples of 16 bytes (table index k), in order, into s (16 * 8 >> k values), given their low and high
+               nibbles: the samples within a nibble are looked up with pshufb */
+            __attribute__((target("avx2")))
+            inline void _unpack16(__m128i lo, __m128i hi, int k, uint8_t * s) {
+                __m128i * out = reinterpret_cast<__m128i *>(s);
+                if (k == 2) {
+                    // 4-bit: the nibbles are the samples
+                    _mm_storeu_si128(out, _mm_unpacklo_epi8(lo, hi));
+                    _mm_storeu_si128(out + 1, _mm_unpackhi_epi8(lo, hi));
+                }
+                else if (k == 1) {
+                    // 2-bit: two samples per nibble
+                    const __m128i crumb0 = _mm_setr_epi8(0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3);
+                    const __m128i crumb1 = _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3);
+                    __m128i c0 = _mm_shuffle_epi8(crumb0, lo), c1 = _mm_shuffle_epi8(crumb1, lo);
+                    __m128i c2 = _mm_shuffle_epi8(crumb0, hi), c3 = _mm_shuffle_epi8(crumb1, hi);
+                    __m128i p01 = _mm_unpacklo_epi8(c0, c1), p23 = _mm_unpacklo_epi8(c2, c3);
+                    _mm_storeu_si128(out, _mm_unpacklo_epi16(p01, p23));
+                    _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(p01, p23));
+                    p01 = _mm_unpackhi_epi8(c0, c1);
+                    p23 = _mm_unpackhi_epi8(c2, c3);
+                    _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(p01, p23));
+                    _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(p01, p23));
                 }
                 else {
-                    for (int i = 0; i < p.cols; i++) {
-                        c.at<cv::Vec3b>(0, i)[0] = (uchar)lut_b[p.at<uchar>(0, i)];
-                        c.at<cv::Vec3b>(0, i)[1] = (uchar)lut_g[p.at<uchar>(0, i)];
-                        c.at<cv::Vec3b>(0, i)[2] = (uchar)lut_r[p.at<uchar>(0, i)];
+                    // 1-bit: four samples per nibble
+                    const __m128i bit[4] = {
+                        _mm_setr_epi8(0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1),
+                        _mm_setr_epi8(0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1),
+                        _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 0, 0, 1, 1, 1, 1),
+                        _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1)
+                    };
+                    __m128i x[8];
+                    for (int j = 0; j < 4; ++j) {
+                        x[j] = _mm_shuffle_epi8(bit[j], lo);
+                        x[j + 4] = _mm_shuffle_epi8(bit[j], hi);
+                    }
+                    // interleave bytes 0-7 (h = 0), then 8-15 (h = 1)
+                    for (int h = 0; h < 2; ++h) {
+                        __m128i p01 = h ? _mm_unpackhi_epi8(x[0], x[1]) : _mm_unpacklo_epi8(x[0], x[1]);
+                        __m128i p23 = h ? _mm_unpackhi_epi8(x[2], x[3]) : _mm_unpacklo_epi8(x[2], x[3]);
+                        __m128i p45 = h ? _mm_unpackhi_epi8(x[4], x[5]) : _mm_unpacklo_epi8(x[4], x[5]);
+                        __m128i p67 = h ? _mm_unpackhi_epi8(x[6], x[7]) : _mm_unpacklo_epi8(x[6], x[7]);
+                        __m128i q_lo = _mm_unpacklo_epi16(p01, p23), r_lo = _mm_unpacklo_epi16(p45, p67);
+                        __m128i q_hi = _mm_unpackhi_epi16(p01, p23), r_hi = _mm_unpackhi_epi16(p45, p67);
+                        _mm_storeu_si128(out + 4 * h, _mm_unpacklo_epi32(q_lo, r_lo));
+                        _mm_storeu_si128(out + 4 * h + 1, _mm_unpackhi_epi32(q_lo, r_lo));
+                        _mm_storeu_si128(out + 4 * h + 2, _mm_unpacklo_epi32(q_hi, r_hi));
+                        _mm_storeu_si128(out + 4 * h + 3, _mm_unpackhi_epi32(q_hi, r_hi));
+                    }
+                }
+            }
+
+            /* AVX2 version of the unpack kernel, 16 bytes at a time */
+            __attribute__((target("avx2")))
+            void _unpack_avx2(const uint8_t * bytes, int64_t n_bytes, int k, double * out, double scale) {
+                const __m128i low4 = _mm_set1_epi8(0x0F);
+                const __m256d sc = _mm256_set1_pd(scale);
+                int per_byte = 8 >> k;
+                uint8_t s[16 * 8];
+                int64_t b = 0;
+                for (; b + 16 <= n_bytes; b += 16, out += 16 * per_byte) {
+                    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + b));
+                    _unpack16(_mm_and_si128(v, low4), _mm_and_si128(_mm_srli_epi16(v, 4), low4), k, s);
+                    // add the samples, 4 at a time (as in the scalar kernel: out += sample * scale)
+                    for (int j = 0; j < 16 * per_byte; j += 4) {
+                        int32_t four;
+                        memcpy(&four, s + j, sizeof(four));
+                        __m256d x = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(four)));
+                        _mm256_storeu_pd(out + j, _mm256_add_pd(_mm256_loadu_pd(out + j), _mm256_mul_pd(x, sc)));
+                    }
+                }
+                _unpack_scalar(bytes + b, n_bytes - b, k, out, scale);
+            }
+
+            /* AVX2 version of the sum kernel, 32 bytes at a time: the sums of each nibble's samples are looked up
+               with pshufb (the first 16 entries of the byte sum table), then added up with psadbw */
+            __attribute__((target("avx2")))
+            int64_t _sum_avx2(const uint8_t * bytes, int64_t n_bytes, int k) {
+                const __m256i lut = _mm256_broadcastsi128_si256(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(_packed_tables().sum[k])));
+                const __m256i low4 = _mm256_set1_epi8(0x0F), zero = _mm256_setzero_si256();
+                __m256i acc = zero;
+                int64_t b = 0;
+                for (; b + 32 <= n_bytes; b += 32) {
+                    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + b));
+                    __m256i sums = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(v, low4)),
+                        _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low4)));
+                    acc = _mm256_add_epi64(acc, _mm256_sad_epu8(sums, zero));
+                }
+                int64_t lanes[4];
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), acc);
+                return lanes[0] + lanes[1] + lanes[2] + lanes[3] + _sum_scalar(bytes + b, n_bytes - b, k);
+            }
+#endif
+
+            /* pick the fastest packed sample kernels supported by this CPU */
+            UnpackKernel _select_unpack_kernel() {
+#ifdef WATPLOT_AVX2_KERNEL
+                __builtin_cpu_init();
+                if (__builtin_cpu_supports("avx2")) return _unpack_avx2;
+#endif
+                return _unpack_scalar;
+            }
+
+            SumKernel _select_sum_kernel() {
+#ifdef WATPLOT_AVX2_KERNEL
+                __builtin_cpu_init();
+                if (__builtin_cpu_supports("avx2")) return _sum_avx2;
+#endif
+                return _sum_scalar;
+            }
+
+            /* bins spanning at least this many whole bytes are summed with the sum kernel */
+            const int64_t SUM_KERNEL_BYTES = 32;
+        }
+
+        void bin_runs_packed(const char * in, int nbits, const std::vector<ChannelRun> & runs, int64_t f_lo,
+                             int64_t f_step, double * out, double scale) {
+            static const UnpackKernel unpack = _select_unpack_kernel();
+            static const SumKernel sum_bytes = _select_sum_kernel();
+            const PackedTables & tables = _packed_tables();
+            int k = nbits == 1 ? 0 : (nbits == 2 ? 1 : 2);
+            const uint8_t (*sample)[8] = tables.sample[k];
+            const uint8_t * sum = tables.sum[k];
+            const uint8_t * bytes = reinterpret_cast<const uint8_t *>(in);
+            int64_t per_byte = 8 / nbits;
+
+            for (const ChannelRun & r : runs) {
+                // i: index of the channel in the spectrum, shown at r.lo + (i - r.src)
+                int64_t i = r.src, end = r.src + (r.hi - r.lo);
+                int64_t bin = (r.lo - f_lo) / f_step;
+                if (f_step == 1) {
+                    // one channel per bin: unpack whole bytes straight into the bins
+                    double * o = out + bin;
+                    for (; i < end && i % per_byte; ++i) o[i - r.src] += sample[bytes[i / per_byte]][i % per_byte] * scale;
+                    int64_t n_bytes = (end - i) / per_byte;
+                    unpack(bytes + i / per_byte, n_bytes, k, o + (i - r.src), scale);
+                    i += n_bytes * per_byte;
+                    for (; i < end; ++i) o[i - r.src] += sample[bytes[i / per_byte]][i % per_byte] * scale;
+                    continue;
+                }
+
+                // index of the first channel of the next bin
+                int64_t next = r.src + f_lo + (bin + 1) * f_step - r.lo;
+                while (i < end) {
+                    int64_t stop = min(next, end), acc = 0;
+                    for (; i < stop && i % per_byte; ++i) acc += sample[bytes[i / per_byte]][i % per_byte];
+                    if (stop - i >= SUM_KERNEL_BYTES * per_byte) {
+                        int64_t n_bytes = (stop - i) / per_byte;
+                        acc += sum_bytes(bytes + i / per_byte, n_bytes, k);
+                        i += n_bytes * per_byte;
                     }
+                    for (; i + per_byte <= stop; i += per_byte) acc += sum[bytes[i / per_byte]];
+                    for (; i < stop; ++i) acc += sample[bytes[i / per_byte]][i % per_byte];
+                    out[bin++] += acc * scale;
+                    next += f_step;
                 }
+            }
+        }
 
-                color = c.reshape(0, gray.rows);
+        LogHistogram::LogHistogram() : counts(BINS) { }
+
+        void LogHistogram::add(const float * x, int n_x) {
+            for (int i = 0; i < n_x; ++i) {
+                if (x[i] > 0.f) {
+                    uint32_t bits;
+                    memcpy(&bits, x + i, sizeof(bits));
+                    ++counts[bits >> SHIFT];
+                    min_val = min(min_val, x[i]);
+                    max_val = max(max_val, x[i]);
+                    ++n;
+                }
+                else if (x[i] <= 0.f) {
+                    ++n_zero;
+                    ++n;
+                }
             }
         }
 
+        void LogHistogram::merge(const LogHistogram & other) {
+            for (int b = 0; b < BINS; ++b) counts[b] += other.counts[b];
+            n_zero += other.n_zero;
+            n += other.n;
+            min_val = min(min_val, other.min_val);
+            max_val = max(max_val, other.max_val);
+        }
+
+        int64_t LogHistogram::size() const {
+            return n;
+        }
+
+        float LogHistogram::percentile(double p) const {
+            if (n == 0) return NAN;
+            // rank of the value among the sorted values, from 0 to n - 1
+            double rank = min(max(p, 0.0), 100.0) / 100.0 * (n - 1);
+            if (rank < n_zero) return 0.f;
+            if (rank <= 0.0) return min_val;
+            if (rank >= n - 1) return max_val;
+            double below = static_cast<double>(n_zero);
+            for (int b = 0; b < BINS; ++b) {
+                if (counts[b] == 0 || below + counts[b] <= rank) {
+                    below += counts[b];
+                    continue;
+                }
+                uint32_t lo_bits = static_cast<uint32_t>(b) << SHIFT, hi_bits = lo_bits + (1u << SHIFT);
+                float lo, hi;
+                memcpy(&lo, &lo_bits, sizeof(lo));
+                memcpy(&hi, &hi_bits, sizeof(hi));
+                float val = static_cast<float>(lo + (hi - lo) * ((rank - below + 0.5) / counts[b]));
+                return min(max(val, min_val), max_val);
+            }
+            return max_val;
+        }
+
+        namespace {
+            /* margin around rasterized labels, in pixels and in text heights (glyphs may reach a little
+             * outside of their text size) */
+            const int LABEL_PAD = 2;
+            const double LABEL_PAD_HEIGHTS = 0.5;
+        }
+
+        const size_t LabelCache::MAX_LABELS = 4096;
+
+        void LabelCache::draw(cv::Mat & img, const std::string & text, cv::Point org, double font_scale,
+                              const cv::Scalar & color) {
+            auto key = std::make_pair(text, font_scale);
+            auto it = labels.find(key);
+            if (it == labels.end()) {
+                if (labels.size() >= MAX_LABELS) labels.clear();
+                int baseline;
+                cv::Size size = cv::getTextSize(text, 0, font_scale, 1, &baseline);
+                int pad = LABEL_PAD + static_cast<int>(size.height * LABEL_PAD_HEIGHTS);
+                Label label;
+                label.org = cv::Point(pad, pad + size.height);
+                label.mask = cv::Mat::zeros(size.height + baseline + 2 * pad, size.width + 2 * pad, CV_8U);
+                cv::putText(label.mask, text, label.org, 0, font_scale, cv::Scalar(255));
+                it = labels.insert(std::make_pair(key, label)).first;
+            }
+
+            // (clipped to the image, as putText does)
+            const Label & label = it->second;
+            cv::Rect dst(org - label.org, label.mask.size());
+            cv::Rect clipped = dst & cv::Rect(0, 0, img.cols, img.rows);
+            if (clipped.area() <= 0) return;
+            img(clipped).setTo(color, label.mask(clipped - dst.tl()));
+        }
+
         std::string round(double dbl, int digs) {
             std::stringstream sstm;
             sstm << std::fixed << std::setprecision(digs);
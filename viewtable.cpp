@@ -0,0 +1,145 @@
+#include "stdafx.h"
+#include "viewtable.hpp"
+#include "threadpool.hpp"
+
+namespace watplot {
+    const int ViewTable::TILE_SHIFT;
+    const int64_t ViewTable::TILE;
+
+    void ViewTable::begin(int64_t rows, int64_t cols) {
+        clear();
+        _rows = rows;
+        _cols = cols;
+        cur.assign(rows, 0.0);
+        if (_storage == DOUBLE) {
+            data.resize(rows * cols);
+        }
+        else {
+            local.resize(rows * cols);
+            boundary.resize(rows * ((cols + TILE - 1) >> TILE_SHIFT));
+            top.resize(tile_rows() * cols);
+        }
+    }
+
+    void ViewTable::push_columns(const double * bins, int64_t n, double area) {
+        int64_t c_lo = _n_pushed;
+        _n_pushed += n;
+        ThreadPool & pool = ThreadPool::global();
+
+        // prefix sums within each column, in parallel over the columns
+        scan.resize(_rows * n);
+        pool.parallel_for(0, static_cast<int>(n), 1, [&](int lo, int hi) {
+            for (int64_t i = lo; i < hi; ++i) {
+                std::partial_sum(bins + i * _rows, bins + (i + 1) * _rows, scan.begin() + i * _rows);
+            }
+        });
+
+        // add them to those of the previous columns, in parallel over blocks of TILE rows
+        // (each block walks the new columns in order; tile-local sums only need rows within the block)
+        int64_t n_k = tile_rows();
+        pool.parallel_for(0, static_cast<int>(n_k), 1, [&](int k_lo, int k_hi) {
+            for (int64_t k = k_lo; k < k_hi; ++k) {
+                int64_t r0 = k << TILE_SHIFT, r1 = min(r0 + TILE, _rows);
+                for (int64_t c = c_lo; c < c_lo + n; ++c) {
+                    const double * col_sum = scan.data() + (c - c_lo) * _rows;
+                    for (int64_t r = r0; r < r1; ++r) {
+                        cur[r] += col_sum[r] / area;
+                    }
+                    if (_storage == DOUBLE) {
+                        std::copy(cur.begin() + r0, cur.begin() + r1, data.begin() + c * _rows + r0);
+                        continue;
+                    }
+
+                    int64_t j = c >> TILE_SHIFT;
+                    double * bnd = boundary.data() + j * _rows;
+                    if ((c & (TILE - 1)) == 0) {
+                        // left boundary of a new column of tiles
+                        std::copy(cur.begin() + r0, cur.begin() + r1, bnd + r0);
+                    }
+                    top[c * n_k + k] = cur[r0];
+                    float * loc = local.data() + c * _rows;
+                    for (int64_t r = r0; r < r1; ++r) {
+                        // sum of bins within the tile, up to (r, c)
+                        loc[r] = static_cast<float>((cur[r] - cur[r0]) - (bnd[r] - bnd[r0]));
+                    }
+                }
+            }
+        });
+    }
+
+    void ViewTable::mark() {
+        marked = cur;
+        _n_marked = _n_pushed;
+    }
+
+    void ViewTable::rewind() {
+        if (_n_marked < 0) return;
+        cur.swap(marked);
+        _n_pushed = _n_marked;
+        _n_marked = -1;
+        std::vector<double>().swap(marked);
+    }
+
+    double ViewTable::operator()(int64_t r, int64_t c) const {
+        c = min(c, _n_pushed - 1);
+        if (_storage == DOUBLE) return data[c * _rows + r];
+        int64_t k = r >> TILE_SHIFT, j = c >> TILE_SHIFT;
+        double offset = top[c * tile_rows() + k] - top[(j << TILE_SHIFT) * tile_rows() + k];
+        return offset + boundary[j * _rows + r] + local[c * _rows + r];
+    }
+
+    ViewTable::Column ViewTable::column(int64_t c, double * offsets_buf) const {
+        c = min(c, _n_pushed - 1);
+        Column col;
+        if (_storage == DOUBLE) {
+            col.data = data.data() + c * _rows;
+            col.offsets = col.boundary = nullptr;
+            col.local = nullptr;
+            return col;
+        }
+        int64_t j = c >> TILE_SHIFT, n_k = tile_rows();
+        const double * tp = top.data() + c * n_k, * tp_bnd = top.data() + (j << TILE_SHIFT) * n_k;
+        for (int64_t k = 0; k < n_k; ++k) {
+            offsets_buf[k] = tp[k] - tp_bnd[k];
+        }
+        col.data = nullptr;
+        col.offsets = offsets_buf;
+        col.boundary = boundary.data() + j * _rows;
+        col.local = local.data() + c * _rows;
+        return col;
+    }
+
+    void ViewTable::swap(ViewTable & other) {
+        std::swap(_storage, other._storage);
+        std::swap(_rows, other._rows);
+        std::swap(_cols, other._cols);
+        std::swap(_n_pushed, other._n_pushed);
+        std::swap(_n_marked, other._n_marked);
+        std::swap(source, other.source);
+        data.swap(other.data);
+        local.swap(other.local);
+        boundary.swap(other.boundary);
+        top.swap(other.top);
+        cur.swap(other.cur);
+        marked.swap(other.marked);
+        scan.swap(other.scan);
+    }
+
+    void ViewTable::clear() {
+        _rows = _cols = _n_pushed = 0;
+        _n_marked = -1;
+        std::vector<double>().swap(data);
+        std::vector<float>().swap(local);
+        std::vector<double>().swap(boundary);
+        std::vector<double>().swap(top);
+        std::vector<double>().swap(cur);
+        std::vector<double>().swap(marked);
+        std::vector<double>().swap(scan);
+    }
+
+    double ViewTable::bytes_per_entry(Storage storage) {
+        if (storage == DOUBLE) return sizeof(double);
+        // local sums, plus one boundary entry per tile row/column
+        return sizeof(float) + 2.0 * sizeof(double) / TILE;
+    }
+}